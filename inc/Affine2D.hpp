@@ -0,0 +1,31 @@
+#ifndef __AFFINE2D_HPP
+#define __AFFINE2D_HPP
+
+/// \brief A 2D affine transform: x' = a x + b y + tx, y' = c x + d y + ty
+///
+/// Transforms compose right to left like matrices, so `Translation(x, y) *
+/// Rotation(angle)` rotates first and then translates.
+struct Affine2D
+{
+  float a = 1.0f, b = 0.0f, tx = 0.0f;
+  float c = 0.0f, d = 1.0f, ty = 0.0f;
+
+  Affine2D();
+  Affine2D(float a, float b, float tx, float c, float d, float ty);
+
+  static Affine2D Translation(float x, float y);
+  /// \brief Counterclockwise on screen (where y points down, that is from +x towards -y)
+  static Affine2D Rotation(float radians);
+  static Affine2D Scale(float sx, float sy);
+  /// \brief Scales and rotates about (cx, cy), then moves that point to (x, y)
+  static Affine2D Place(float x, float y, float radians, float scale, float cx, float cy);
+
+  /// \brief This transform applied after `other`
+  Affine2D operator*(const Affine2D &other) const;
+  float Determinant() const;
+  /// \brief Writes the inverse to `out`; returns false (leaving `out` alone) when there is none
+  bool Invert(Affine2D &out) const;
+  void Apply(float x, float y, float &outX, float &outY) const;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __ATLAS_HPP
+#define __ATLAS_HPP
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Window.hpp"
+
+/// \brief Packs many small sprites into a few large pages, each one SDL_Texture
+///
+/// Sprites are placed with the skyline packer from imstb_rectpack.h as they
+/// are inserted. Their pixels are kept in a CPU copy of each page and uploaded
+/// in one SDL_UpdateTexture per page, covering everything changed since the
+/// last upload. Removing a sprite only frees its space once its page is
+/// empty or Defragment repacks every page.
+class Atlas
+{
+public:
+  typedef uint32_t Handle;
+  static const Handle INVALID = 0xFFFFFFFF;
+
+  /// \brief Where a sprite lives: its page's texture and its rectangle on that page
+  struct Region
+  {
+    SDL_Texture *texture;
+    int32_t page;
+    SDL_Rect rect;
+  };
+
+  /// \brief Creates pages on `renderer`, which may be null to pack without any textures
+  ///
+  /// `padding` transparent pixels are kept between sprites so filtered draws do not bleed.
+  Atlas(SDL_Renderer *renderer, int32_t pageWidth = 1024, int32_t pageHeight = 1024, int32_t padding = 1);
+  Atlas(const Atlas &) = delete;
+  Atlas &operator=(const Atlas &) = delete;
+  ~Atlas();
+
+  /// \brief Copies `sprite` into the first page with room, adding a page when none has any
+  ///
+  /// Returns INVALID (and logs) when the sprite is empty or bigger than a page.
+  Handle Insert(const Sprite &sprite);
+  Handle Insert(const Sprite &sprite, SDL_Rect src);
+  /// \brief Forgets a sprite; its handle may be returned by a later Insert
+  bool Remove(Handle handle);
+  bool Contains(Handle handle) const;
+
+  /// \brief Where `handle` is, after uploading its page; handles stay valid across Defragment
+  Region Get(Handle handle);
+  /// \brief SDL_RenderCopy of the sprite to `dst` on the atlas renderer
+  bool Draw(Handle handle, const SDL_Rect &dst, SDL_RendererFlip flip = SDL_FLIP_NONE);
+
+  /// \brief Repacks every live sprite into as few pages as possible, tallest first
+  ///
+  /// Returns the number of pages released.
+  int32_t Defragment();
+  /// \brief Uploads every page changed since its last upload
+  void Upload();
+
+  int32_t GetPageCount() const;
+  /// \brief The texture of `page`, after uploading it
+  SDL_Texture *GetPage(int32_t page);
+  /// \brief The CPU copy of `page`
+  const Sprite &GetPagePixels(int32_t page) const;
+  int32_t GetPageWidth() const;
+  int32_t GetPageHeight() const;
+  /// \brief Live sprite area (padding included) over the area of every page, 0 to 1
+  float GetOccupancy() const;
+
+private:
+  struct Page;
+  struct Entry
+  {
+    int32_t page;
+    SDL_Rect rect;
+    bool live;
+  };
+
+  Page *AddPage();
+  SDL_Texture *CreateTexture();
+  void Blit(Page &page, int32_t x, int32_t y, const Pixel *src, int32_t pitch, int32_t w, int32_t h);
+  void UploadPage(Page &page);
+
+  SDL_Renderer *renderer;
+  int32_t pageWidth, pageHeight, padding;
+  std::vector<std::unique_ptr<Page>> pages;
+  std::vector<Entry> entries;
+  std::vector<Handle> freeHandles;
+};
+
+#endif
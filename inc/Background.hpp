@@ -0,0 +1,63 @@
+#ifndef __BACKGROUND_HPP
+#define __BACKGROUND_HPP
+#include <cstdint>
+#include <vector>
+
+#include "Window.hpp"
+
+class PatternTable;
+
+/// \brief A scrolling grid of 8x8 tiles from a PatternTable (a nametable)
+///
+/// Each cell names a tile, the palette to draw it with and how to flip it.
+/// The grid wraps in both directions, so scrolling past an edge shows the
+/// other side. Rows are rendered a screen scanline at a time, decoding each
+/// tile row straight from the pattern table into the output.
+class Background
+{
+public:
+  struct Cell
+  {
+    uint16_t tile;
+    uint8_t palette;
+    uint8_t flip;
+  };
+
+  Background();
+  Background(const PatternTable *patterns, int32_t columns, int32_t rows);
+
+  /// \brief Reallocates the grid with every cell tile 0, palette 0, unflipped
+  void Resize(int32_t columns, int32_t rows);
+  void SetPatterns(const PatternTable *patterns);
+  const PatternTable *GetPatterns() const;
+
+  Cell GetCell(int32_t column, int32_t row) const;
+  bool SetCell(int32_t column, int32_t row, Cell cell);
+  bool SetCell(int32_t column, int32_t row, uint16_t tile, uint8_t palette = 0, uint8_t flip = Sprite::NONE);
+
+  /// \brief The background pixel drawn at the screen's top left corner
+  void SetScroll(int32_t x, int32_t y);
+  int32_t GetScrollX() const;
+  int32_t GetScrollY() const;
+
+  /// \brief Writes `count` pixels of screen row `y`, starting at screen column `x`
+  ///
+  /// With no pattern table every pixel is Color::BLANK.
+  void RenderRow(int32_t y, int32_t x, int32_t count, Pixel *out) const;
+
+  int32_t GetColumns() const;
+  int32_t GetRows() const;
+  /// \brief Size of the whole grid in pixels
+  int32_t GetWidth() const;
+  int32_t GetHeight() const;
+
+private:
+  const PatternTable *patterns = nullptr;
+  int32_t columns = 0;
+  int32_t rows = 0;
+  int32_t scrollX = 0;
+  int32_t scrollY = 0;
+  std::vector<Cell> cells;
+};
+
+#endif
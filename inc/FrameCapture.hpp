@@ -0,0 +1,63 @@
+#ifndef __FRAMECAPTURE_HPP
+#define __FRAMECAPTURE_HPP
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Pixel;
+
+/// \brief Records frames to disk from a background thread
+///
+/// Frames are copied into a fixed pool of preallocated buffers and encoded
+/// by a writer thread. Submit never waits on the writer: when every buffer
+/// is still queued the frame is dropped and counted instead.
+class FrameCapture
+{
+public:
+  enum Format
+  {
+    QOI,  ///< One .qoi file per frame, `<path>_000000.qoi`
+    PNG,  ///< One uncompressed .png file per frame, `<path>_000000.png`
+    Y4M,  ///< A single YUV4MPEG2 (4:4:4) stream written to `path`
+    RGBA  ///< A single stream of raw RGBA frames written to `path`
+  };
+
+  FrameCapture(const std::string &path, Format format, int32_t width, int32_t height, unsigned poolSize = 8, unsigned fps = 60);
+  /// \brief Writes out every frame still queued, then stops the writer
+  ~FrameCapture();
+
+  /// \brief Queues a copy of `frame`; returns false if it had to be dropped
+  bool Submit(const Pixel *frame);
+
+  uint32_t GetWritten();
+  uint32_t GetDropped();
+
+private:
+  void WriterLoop();
+  void Write(const std::vector<Pixel> &frame);
+
+  std::string path;
+  Format format;
+  int32_t width, height;
+  unsigned fps;
+  std::ofstream stream;
+  std::vector<uint8_t> encoded;
+
+  std::vector<std::vector<Pixel>> buffers;
+  std::vector<size_t> freeBuffers;
+  std::deque<size_t> queuedBuffers;
+  std::mutex buffersLocked;
+  std::condition_variable frameQueued;
+  bool stopping = false;
+
+  uint32_t written = 0;
+  uint32_t dropped = 0;
+  std::thread writer;
+};
+
+#endif
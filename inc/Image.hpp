@@ -0,0 +1,30 @@
+#ifndef __IMAGE_HPP
+#define __IMAGE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Pixel;
+
+/// \brief Image file encoders and decoders working on tightly packed rows of Pixels
+namespace Image
+{
+  enum Format { UNKNOWN, BMP, PNG, QOI };
+
+  /// \brief Identifies an in-memory image file by its contents and reads its size without decoding it
+  Format Probe(const uint8_t *data, size_t size, int32_t &width, int32_t &height);
+  /// \brief Decodes a file Probe recognised into its width * height Pixels; logs and returns false on malformed data
+  ///
+  /// Handles uncompressed and bitfield BMPs, every PNG color type, bit depth
+  /// and interlacing, and QOI. Safe to call from several threads at once.
+  bool Decode(const uint8_t *data, size_t size, Pixel *pixels);
+
+  /// \brief Appends a QOI ("Quite OK Image") file to `out`
+  void EncodeQOI(const Pixel *pixels, int32_t width, int32_t height, std::vector<uint8_t> &out);
+  /// \brief Appends an uncompressed (stored deflate) PNG file to `out`
+  ///
+  /// Favors encode speed over size, which is what frame capture wants.
+  void EncodePNG(const Pixel *pixels, int32_t width, int32_t height, std::vector<uint8_t> &out);
+} // namespace Image
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __INDEXEDSPRITE_HPP
+#define __INDEXEDSPRITE_HPP
+#include <cstdint>
+#include <vector>
+
+#include "Window.hpp"
+
+/// \brief A sprite storing 1, 2, 4 or 8 bit palette indices instead of Pixels
+///
+/// Indices are packed from the least significant bits of each byte (pixel 0
+/// of a byte is its low bits) and every row starts on a 32 bit boundary.
+/// Colors are only looked up when the sprite is drawn, so changing the
+/// palette, or drawing with a different one, costs nothing.
+class IndexedSprite
+{
+public:
+  IndexedSprite();
+  IndexedSprite(int32_t w, int32_t h, uint8_t bitsPerPixel);
+
+  /// \brief Reallocates for `bitsPerPixel` (1, 2, 4 or 8) with every index 0 and a grey ramp palette
+  void Resize(int32_t w, int32_t h, uint8_t bitsPerPixel);
+  /// \brief Rebuilds this sprite from the colors of `sprite`; fails if it uses more than 2^bitsPerPixel colors
+  bool FromSprite(const Sprite &sprite, uint8_t bitsPerPixel);
+
+  uint8_t GetIndex(int32_t x, int32_t y) const;
+  bool SetIndex(int32_t x, int32_t y, uint8_t index);
+  /// \brief The color at (x, y) through the sprite's own palette, or Color::BLANK outside it
+  Pixel GetPixel(int32_t x, int32_t y) const;
+
+  /// \brief Replaces the first `count` palette entries
+  void SetPalette(const Pixel *colors, int32_t count);
+  void SetPaletteColor(uint8_t index, Pixel color);
+  Pixel GetPaletteColor(uint8_t index) const;
+  /// \brief The palette, 2^bitsPerPixel entries long
+  const Pixel *GetPalette() const;
+
+  /// \brief Writes the colors of `count` pixels of row `y`, starting at column `x`
+  ///
+  /// Uses `palette` (which needs 2^bitsPerPixel entries) instead of the sprite's own when given.
+  void ExpandRow(int32_t x, int32_t y, int32_t count, Pixel *out, const Pixel *palette = nullptr) const;
+
+  int32_t GetWidth() const;
+  int32_t GetHeight() const;
+  uint8_t GetBitsPerPixel() const;
+  /// \brief Bytes from one row of indices to the next
+  int32_t GetPitch() const;
+  const uint8_t *GetData() const;
+  uint8_t *GetData();
+
+private:
+  int32_t width = 0;
+  int32_t height = 0;
+  uint8_t bits = 8;
+  int32_t pitch = 0;
+  std::vector<uint8_t> indices;
+  std::vector<Pixel> palette;
+};
+
+#endif
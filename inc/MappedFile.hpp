@@ -0,0 +1,37 @@
+#ifndef __MAPPEDFILE_HPP
+#define __MAPPEDFILE_HPP
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// \brief A read-only view of a whole file mapped into memory
+///
+/// Uses CreateFileMapping on Windows and mmap elsewhere, so reading the file
+/// costs no copy into a user buffer; pages are faulted in as they are touched.
+class MappedFile
+{
+public:
+  MappedFile();
+  MappedFile(const std::string &path);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  /// \brief Maps `path`, replacing any file already mapped; returns false (and logs) on failure
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const;
+  const uint8_t *GetData() const;
+  size_t GetSize() const;
+
+private:
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  void *file = nullptr;
+  void *mapping = nullptr;
+#endif
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __OBJECTLAYER_HPP
+#define __OBJECTLAYER_HPP
+#include <cstdint>
+#include <vector>
+
+#include "Window.hpp"
+
+class PatternTable;
+
+/// \brief A fixed size table of 8x8 objects drawn from a PatternTable, like a console's OAM
+///
+/// Before drawing, objects are sorted into buckets of the scanlines they
+/// cover, so a line only ever looks at the objects on it. Lower entries are
+/// in front of higher ones. Objects flagged BEHIND only show where the
+/// background under them is transparent. With a line limit set, objects past
+/// the limit on a line are dropped there, the way sprite hardware does.
+class ObjectLayer
+{
+public:
+  /// \brief Object flags, used alongside Sprite::HORIZ and Sprite::VERT
+  enum Flags { BEHIND = 4, HIDDEN = 8 };
+
+  struct Object
+  {
+    int16_t x, y;
+    uint16_t tile;
+    uint8_t palette;
+    uint8_t flags;
+  };
+
+  /// \brief `capacity` objects, all hidden
+  ObjectLayer(const PatternTable *patterns = nullptr, int32_t capacity = 64);
+
+  void SetPatterns(const PatternTable *patterns);
+  const PatternTable *GetPatterns() const;
+
+  int32_t GetCapacity() const;
+  Object GetObject(int32_t index) const;
+  bool SetObject(int32_t index, const Object &object);
+  bool SetObject(int32_t index, int32_t x, int32_t y, uint16_t tile, uint8_t palette = 0, uint8_t flags = Sprite::NONE);
+  /// \brief Hides every object
+  void Clear();
+
+  /// \brief At most `limit` objects are drawn on one scanline; 0 draws them all
+  void SetLineLimit(int32_t limit);
+  int32_t GetLineLimit() const;
+
+  /// \brief Buckets the visible objects by scanline, if anything changed since the last time
+  ///
+  /// RenderRow does this itself; calling it first lets several threads render rows at once.
+  void Evaluate() const;
+  /// \brief The indices of the objects drawn on scanline `y`, front first
+  const uint16_t *GetLine(int32_t y, int32_t &count) const;
+  /// \brief How many object rows the line limit dropped, over every scanline
+  int32_t GetDroppedCount() const;
+
+  /// \brief Composites the objects on screen row `y` over `count` (up to SCREEN_WIDTH) pixels of `row`, starting at column `x`
+  ///
+  /// `row` holds the background; objects cover any of its pixels unless they
+  /// are BEHIND, which only covers pixels with no alpha. Returns false when no
+  /// object touches the span.
+  bool RenderRow(int32_t y, int32_t x, int32_t count, Pixel *row) const;
+
+private:
+  const PatternTable *patterns;
+  std::vector<Object> objects;
+  int32_t lineLimit = 0;
+  mutable bool evaluated = false;
+  mutable int32_t dropped = 0;
+  mutable int32_t lineStart[SCREEN_HEIGHT + 1];
+  mutable std::vector<uint16_t> lineObjects;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __PATTERNTABLE_HPP
+#define __PATTERNTABLE_HPP
+#include <cstdint>
+#include <vector>
+
+#include "Window.hpp"
+
+class IndexedSprite;
+
+/// \brief A bank of 8x8 tiles of packed palette indices, and the palettes they are drawn with
+///
+/// Each tile keeps its 8 rows next to each other (a row is `bitsPerPixel`
+/// bytes, packed like IndexedSprite), so decoding a tile row touches a single
+/// small run of memory. Every palette has 2^bitsPerPixel colors; index 0 of
+/// each starts out transparent so tiles can be layered.
+class PatternTable
+{
+public:
+  static const int32_t TILE_SIZE = 8;
+
+  PatternTable();
+  PatternTable(int32_t tiles, uint8_t bitsPerPixel, int32_t palettes = 8);
+
+  /// \brief Reallocates for `tiles` tiles of `bitsPerPixel` (1, 2, 4 or 8), every index 0 and grey ramp palettes
+  void Resize(int32_t tiles, uint8_t bitsPerPixel, int32_t palettes = 8);
+  /// \brief Cuts `sheet` into 8x8 tiles, left to right and top to bottom, and takes its palette as palette 0
+  bool FromSprite(const IndexedSprite &sheet);
+
+  uint8_t GetIndex(int32_t tile, int32_t x, int32_t y) const;
+  bool SetIndex(int32_t tile, int32_t x, int32_t y, uint8_t index);
+
+  /// \brief Replaces the first `count` colors of `palette`
+  void SetPalette(int32_t palette, const Pixel *colors, int32_t count);
+  void SetPaletteColor(int32_t palette, uint8_t index, Pixel color);
+  Pixel GetPaletteColor(int32_t palette, uint8_t index) const;
+  /// \brief The colors of `palette` (clamped to the last one), 2^bitsPerPixel long
+  const Pixel *GetPalette(int32_t palette) const;
+
+  /// \brief Writes the colors of `count` pixels of row `y` of `tile`, starting at column `x`
+  ///
+  /// `flip` (Sprite::HORIZ, Sprite::VERT) mirrors the tile before the row is read.
+  void ExpandRow(int32_t tile, int32_t y, int32_t x, int32_t count, uint8_t flip, const Pixel *palette, Pixel *out) const;
+
+  int32_t GetTileCount() const;
+  uint8_t GetBitsPerPixel() const;
+  int32_t GetPaletteCount() const;
+  const uint8_t *GetData() const;
+  uint8_t *GetData();
+
+private:
+  int32_t tileCount = 0;
+  uint8_t bits = 2;
+  int32_t paletteCount = 0;
+  std::vector<uint8_t> patterns;
+  std::vector<Pixel> colors;
+};
+
+#endif
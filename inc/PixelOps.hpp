@@ -0,0 +1,63 @@
+#ifndef __PIXELOPS_HPP
+#define __PIXELOPS_HPP
+#include <cstdint>
+
+struct Pixel;
+
+/// \brief Row kernels that operate on runs of contiguous Pixels
+///
+/// Each kernel picks an AVX2, SSE2 or scalar implementation once at runtime
+/// (through SDL's CPU feature detection), so callers never need to care
+/// which instruction set is available.
+namespace PixelOps
+{
+  /// \brief Writes `count` copies of `color` starting at `dst`
+  void Fill(Pixel *dst, Pixel color, int32_t count);
+  /// \brief Copies `count` pixels from `src` to `dst` (the ranges must not overlap)
+  void Copy(Pixel *dst, const Pixel *src, int32_t count);
+  /// \brief Copies only the pixels of `src` whose alpha is 255
+  void CopyMask(Pixel *dst, const Pixel *src, int32_t count);
+  /// \brief Composites `src` over `dst` using the source alpha
+  void BlendAlpha(Pixel *dst, const Pixel *src, int32_t count);
+  /// \brief Composites one `color` over each of `count` pixels at `dst`
+  void BlendAlpha(Pixel *dst, Pixel color, int32_t count);
+  /// \brief Writes `color` to each of the first `count` (at most 64) pixels whose bit is set in `mask`
+  ///
+  /// Bit 0 is `dst[0]`. Used for 1 bit per pixel data such as font glyph rows.
+  void FillMask(Pixel *dst, Pixel color, uint64_t mask, int32_t count);
+  /// \brief Looks up `count` packed palette indices, starting `first` indices into `indices`
+  ///
+  /// Indices are `bits` (1, 2, 4 or 8) wide and packed from the least significant
+  /// bit of each byte. `palette` needs 2^bits entries, and `indices` must stay
+  /// readable for 8 bytes past the last index used.
+  void ExpandIndexed(Pixel *dst, const uint8_t *indices, int32_t first, int32_t count, int bits, const Pixel *palette);
+  /// \brief Writes `count` pixels, each the rounded channel average of a 2x2 block
+  ///
+  /// Pixel i averages `row0[2i]`, `row0[2i + 1]`, `row1[2i]` and `row1[2i + 1]`,
+  /// so both rows need `2 * count` pixels.
+  void Downsample2x2(Pixel *dst, const Pixel *row0, const Pixel *row1, int32_t count);
+
+  /// \brief How sampling treats coordinates outside a texture
+  enum Address
+  {
+    BORDER, ///< Transparent black
+    REPEAT, ///< The texture tiles
+    CLAMP,  ///< The nearest edge texel
+    MIRROR  ///< The texture tiles, flipping every other copy
+  };
+
+  /// \brief Writes `count` nearest-neighbour samples taken along a line through a `width` x `height` texture
+  ///
+  /// `u`, `v`, `du` and `dv` are 16.16 fixed point texel coordinates; sample i
+  /// is taken at (u + i * du, v + i * dv). Each Address mode is a separate
+  /// template instantiation, so the per-sample loop never branches on it.
+  void SampleNearest(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count, Address address);
+  /// \brief Like SampleNearest, but blends the 2x2 texels around each position
+  ///
+  /// Texel centres sit on whole coordinates, so (0.5, 0) is halfway between the first two texels.
+  void SampleBilinear(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count, Address address);
+  /// \brief Composites a single pixel; the scalar reference for the kernels above
+  Pixel BlendAlpha(Pixel src, Pixel dst);
+} // namespace PixelOps
+
+#endif
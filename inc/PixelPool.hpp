@@ -0,0 +1,54 @@
+#ifndef __PIXELPOOL_HPP
+#define __PIXELPOOL_HPP
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+struct Pixel;
+
+/// \brief Recycles 64 byte aligned pixel buffers by size class
+///
+/// Size classes step in quarters of a power of two (64, 80, 96, 112, 128,
+/// 160, ... bytes), so a buffer wastes at most a fifth of its size. Released
+/// buffers are kept on a per-class free list and handed back out by the next
+/// request of the same class, so code that keeps creating and destroying
+/// sprites of similar sizes stops touching the heap after the first round.
+class PixelPool
+{
+public:
+  static const size_t ALIGNMENT = 64;
+
+  ~PixelPool();
+
+  /// \brief Returns an uninitialized buffer with room for at least `count` pixels
+  Pixel *Acquire(size_t count);
+  /// \brief Returns a buffer from Acquire(count) to its free list
+  void Release(Pixel *pixels, size_t count);
+  /// \brief Frees every buffer currently sitting on a free list
+  void Trim();
+
+  /// \brief Whether buffers for `a` and `b` pixels come from the same size class
+  static bool SameClass(size_t a, size_t b);
+
+  /// \brief Bytes held on free lists, waiting to be reused
+  size_t GetCachedBytes();
+  /// \brief Number of buffers that had to be allocated from the heap
+  uint64_t GetHeapAllocations();
+
+  /// \brief The pool Sprite storage comes from
+  static PixelPool &Get();
+
+private:
+  static const size_t CLASS_COUNT = 4 * (32 - 6);
+
+  static size_t ClassIndex(size_t bytes);
+  static size_t ClassBytes(size_t index);
+
+  std::vector<void *> freeLists[CLASS_COUNT];
+  std::mutex listsLocked;
+  size_t cachedBytes = 0;
+  uint64_t heapAllocations = 0;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __TILEMAP_HPP
+#define __TILEMAP_HPP
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "Background.hpp"
+#include "Window.hpp"
+
+class PatternTable;
+
+/// \brief A large grid of tiles drawn from square chunks rendered ahead of time into Sprites
+///
+/// Drawing the map is a handful of chunk blits. A chunk is only rendered
+/// again after one of its cells changes (or Invalidate is called), and the
+/// least recently drawn chunks are dropped once the cache outgrows its
+/// budget. Prefetch renders chunks around the camera on the WorkerPool before
+/// they scroll into view. Unlike Background the map does not wrap.
+class TileMap
+{
+public:
+  typedef Background::Cell Cell;
+
+  /// \brief A `columns` x `rows` map of tile 0, cached in chunks of `chunkTiles` x `chunkTiles` tiles
+  TileMap(const PatternTable *patterns, int32_t columns, int32_t rows, int32_t chunkTiles = 32);
+  TileMap(const TileMap &) = delete;
+  TileMap &operator=(const TileMap &) = delete;
+  /// \brief Waits for any chunk still rendering on a worker
+  ~TileMap();
+
+  /// \brief Replaces the pattern table and invalidates every chunk
+  void SetPatterns(const PatternTable *patterns);
+  const PatternTable *GetPatterns() const;
+
+  Cell GetCell(int32_t column, int32_t row) const;
+  bool SetCell(int32_t column, int32_t row, Cell cell);
+  bool SetCell(int32_t column, int32_t row, uint16_t tile, uint8_t palette = 0, uint8_t flip = Sprite::NONE);
+  /// \brief Re-renders every chunk on next use, for changes the map can't see (tiles or palettes)
+  void Invalidate();
+
+  /// \brief Draws the part of the map under a screen-sized camera whose top left corner is at (cameraX, cameraY)
+  ///
+  /// Chunks drawn by this call and the one before are never evicted, and a
+  /// chunk re-rendered after a SetCell keeps its old sprite for as long, so in
+  /// tiled rendering everything recorded stays alive until EndFrame.
+  void Draw(Window &window, int32_t cameraX, int32_t cameraY);
+  /// \brief Starts rendering, on the WorkerPool, every missing or stale chunk within `margin` pixels of the camera
+  ///
+  /// Workers read the pattern table, so leave it alone until the chunks have been drawn.
+  void Prefetch(int32_t cameraX, int32_t cameraY, int32_t margin);
+  /// \brief The chunk at (chunkX, chunkY), rendered now if it has to be, or null outside the map
+  const Sprite *GetChunk(int32_t chunkX, int32_t chunkY);
+
+  /// \brief The most pixel memory cached chunks may hold, in bytes
+  void SetBudget(size_t bytes);
+  size_t GetBudget() const;
+  size_t GetCachedBytes() const;
+  /// \brief Chunks rendered since the map was created, on workers or not
+  uint32_t GetBuildCount() const;
+
+  int32_t GetColumns() const;
+  int32_t GetRows() const;
+  /// \brief Size of a chunk in pixels
+  int32_t GetChunkSize() const;
+  int32_t GetChunkColumns() const;
+  int32_t GetChunkRows() const;
+
+private:
+  struct Build;
+  struct Chunk
+  {
+    std::unique_ptr<Sprite> sprite;
+    uint64_t edits = 1;
+    uint64_t built = 0;
+    uint32_t lastUse = 0;
+    std::shared_ptr<Build> pending;
+  };
+
+  std::shared_ptr<Build> Snapshot(int32_t index) const;
+  void Adopt(int32_t index);
+  void Trim();
+
+  const PatternTable *patterns;
+  int32_t columns, rows;
+  int32_t chunkTiles;
+  int32_t chunkColumns, chunkRows;
+  std::vector<Cell> cells;
+  std::vector<Chunk> chunks;
+  std::vector<int32_t> cached;
+  // Replaced chunk sprites, kept until the Draw after next in case recorded commands point at them
+  std::vector<std::unique_ptr<Sprite>> retired, retiredBefore;
+  size_t budget = 16 << 20;
+  size_t cachedBytes = 0;
+  uint32_t frame = 1;
+  uint32_t builds = 0;
+};
+
+#endif
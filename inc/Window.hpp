@@ -2,8 +2,14 @@
 #define __WINDOW_HPP
 #include <string>
 #include <vector>
+#include <functional>
+#include <future>
 #include <imgui.h>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include "Affine2D.hpp"
+#include "FrameCapture.hpp"
 #ifdef __WIN32
 #ifndef _MSC_VER
 #include <SDL2/SDL.h>
@@ -16,6 +22,10 @@
 
 std::string hex(uint64_t n, uint8_t d);
 
+class Background;
+class IndexedSprite;
+class ObjectLayer;
+
 static const int SCREEN_WIDTH = 256;
 static const int SCREEN_HEIGHT_STD = 240;
 static const int SCREEN_HEIGHT_4_3 = 341;
@@ -79,37 +89,294 @@ class Sprite
 public:
   Sprite();
   Sprite(int32_t w, int32_t h);
+  Sprite(Sprite &&other) noexcept;
+  Sprite(const Sprite &) = delete;
   ~Sprite();
 
+  Sprite &operator=(Sprite &&other) noexcept;
+  Sprite &operator=(const Sprite &) = delete;
+
+  // Pixel storage is 64 byte aligned and recycled through PixelPool::Get(); every pixel starts as Pixel()
+
   void Resize(int32_t w, int32_t h);
-  Pixel GetPixel(int32_t x, int32_t y);
+  // Decodes a BMP, PNG or QOI file (told apart by content) straight into the sprite's buffer.
+  // The file is memory mapped rather than read; on failure the sprite is left empty.
+  bool Load(const std::string &path);
+  // Runs Load on a WorkerPool thread, so a batch of loads is decoded in parallel.
+  // The sprite must not be touched or destroyed until the future is ready.
+  std::future<bool> LoadAsync(const std::string &path);
+  Pixel GetPixel(int32_t x, int32_t y) const;
   bool  SetPixel(int32_t x, int32_t y, Pixel p);
-  Pixel Sample(float x, float y);
+  // Sample and SampleSpan take normalized coordinates (0 to 1 across the sprite).
+  // Outside the sprite they follow the sample mode, like GetPixel.
+  // `footprint` is how many sprite texels one sample covers, which picks the mip level.
+  Pixel Sample(float x, float y, float footprint = 1.0f) const;
+  Pixel SampleBilinear(float x, float y, float footprint = 1.0f) const;
+  // Writes `count` samples taken at (u0, v0), (u0 + du, v0 + dv), ... stepping in fixed point.
+  // The mip level comes from the length of a step.
+  void SampleSpan(float u0, float v0, float du, float dv, int32_t count, Pixel *out) const;
+  void SampleSpanBilinear(float u0, float v0, float du, float dv, int32_t count, Pixel *out) const;
+
+  int32_t GetWidth() const;
+  int32_t GetHeight() const;
+  Pixel *GetData();
+  const Pixel *GetData() const;
+
+  // Changes when the pixels do (SetPixel, Resize, Load, Invalidate, being moved into). Versions
+  // come from one counter shared by every sprite, so a newer one always means new contents.
+  uint64_t GetVersion() const;
+  // The version at which row y last changed; rows newer than a copy's version need copying again
+  uint64_t GetRowVersion(int32_t y) const;
+  // Marks the rows of `rect` (all of them when null) as changed, for code that writes through GetData
+  void Invalidate(const SDL_Rect *rect = nullptr);
+
+  // How GetPixel and the samplers treat coordinates outside the sprite:
+  // NORMAL reads Color::BLANK, PERIODIC tiles, CLAMP repeats the edge and MIRROR tiles flipped copies
+  enum Mode { NORMAL, PERIODIC, CLAMP, MIRROR };
+  enum Flip { NONE = 0, HORIZ = 1, VERT = 2 };
+
+  void SetSampleMode(Mode mode);
+  Mode GetSampleMode() const;
+
+  // A mip chain holds copies of the sprite at half, quarter, ... size down to 1x1, each a
+  // 2x2 box filter of the level above. The samplers read the level whose texels are closest
+  // to one per sample, so minified sprites alias less and touch fewer texels. Changing the
+  // sprite leaves the chain stale, and stale levels are ignored until it is built again.
+  void BuildMips();
+  // Runs BuildMips on a WorkerPool thread. The sprite must not be touched until the future is ready.
+  std::future<void> BuildMipsAsync();
+  void ClearMips();
+  // 1 for the sprite itself, plus each up to date mip level
+  int32_t GetMipLevels() const;
+  // Level 0 is the sprite itself
+  const Sprite &GetMip(int32_t level) const;
+  // The level to read when one sample covers `footprint` texels of the sprite
+  int32_t SelectMip(float footprint) const;
+
+  // A run of pixels in one row that are either all opaque (alpha 255) or mixed: translucent
+  // pixels along with any short opaque or transparent runs between them. Transparent runs
+  // of SPAN_MIN_RUN pixels or more have no span, and shorter runs stay inside mixed spans
+  // so a blit never makes a kernel call for just a pixel or two.
+  static const int32_t SPAN_MIN_RUN = 8;
+  struct Span
+  {
+    int32_t x, length;
+    bool opaque;
+  };
+
+  // With span encoding on, MASK and ALPHA blits walk each row's spans instead of every pixel:
+  // long transparent runs are skipped, long opaque runs copied and only the rest blended.
+  // The spans are built on the first draw after a change; SetPixel, Resize and Load mark them
+  // stale, while code writing through GetData must call Invalidate itself. It pays off
+  // for sprites with long transparent runs, most of all with MASK or without AVX2, whose
+  // blend kernel already skips whole vectors of transparent pixels.
+  void SetSpanEncoding(bool enabled);
+  bool GetSpanEncoding() const;
+  // Rebuilds the spans if they are stale; GetSpans calls it, but it is not safe to race
+  void UpdateSpans() const;
+  // The spans of row y, left to right
+  const Span *GetSpans(int32_t y, int32_t &count) const;
+
+  // Addressing policies for Texel and Texels. Map folds a coordinate into [0, size) and
+  // returns false only when there is no texel there. The Pow2 variants need a power of two size.
+  struct Border { static bool Map(int32_t &t, int32_t size) { return uint32_t(t) < uint32_t(size); } };
+  struct Clamp { static bool Map(int32_t &t, int32_t size) { t = t < 0 ? 0 : t >= size ? size - 1 : t; return true; } };
+  struct Repeat
+  {
+    static bool Map(int32_t &t, int32_t size)
+    {
+      t %= size;
+      if (t < 0)
+        t += size;
+      return true;
+    }
+  };
+  struct RepeatPow2 { static bool Map(int32_t &t, int32_t size) { t &= size - 1; return true; } };
+  struct Mirror
+  {
+    static bool Map(int32_t &t, int32_t size)
+    {
+      Repeat::Map(t, size * 2);
+      if (t >= size)
+        t = size * 2 - 1 - t;
+      return true;
+    }
+  };
+  struct MirrorPow2 { static bool Map(int32_t &t, int32_t size) { t = (t & size) ? ~t & (size - 1) : t & (size - 1); return true; } };
 
-  enum Mode { NORMAL, PERIODIC };
+  // A texel fetch with its addressing fixed at compile time
+  template <class WrapX, class WrapY = WrapX>
+  struct Texels
+  {
+    const Pixel *data;
+    int32_t width, height;
+
+    explicit Texels(const Sprite &sprite) : data(sprite.pColData), width(sprite.width), height(sprite.height) {}
+    Pixel operator()(int32_t x, int32_t y) const
+    {
+      return WrapX::Map(x, width) && WrapY::Map(y, height) ? data[y * width + x] : Pixel(0, 0, 0, 0);
+    }
+  };
+
+  template <class WrapX, class WrapY = WrapX>
+  Pixel Texel(int32_t x, int32_t y) const
+  {
+    return Texels<WrapX, WrapY>(*this)(x, y);
+  }
+
+  // Calls f(texels) with the Texels matching the sample mode (the Pow2 policies when both
+  // sides allow it), so a loop written inside f is compiled once per mode and never
+  // checks the mode per pixel
+  template <class F>
+  void WithTexels(F &&f) const
+  {
+    const bool pow2 = width > 0 && height > 0 && !(width & (width - 1)) && !(height & (height - 1));
+    if (!pColData)
+      f(Texels<Border>(*this));
+    else if (modeSample == PERIODIC && pow2)
+      f(Texels<RepeatPow2>(*this));
+    else if (modeSample == PERIODIC)
+      f(Texels<Repeat>(*this));
+    else if (modeSample == MIRROR && pow2)
+      f(Texels<MirrorPow2>(*this));
+    else if (modeSample == MIRROR)
+      f(Texels<Mirror>(*this));
+    else if (modeSample == CLAMP)
+      f(Texels<Clamp>(*this));
+    else
+      f(Texels<Border>(*this));
+  }
 private:
+  void Allocate(int32_t w, int32_t h);
+  void Touch(int32_t y0, int32_t y1);
+
   int32_t width = 0;
   int32_t height = 0;
   Pixel *pColData = nullptr;
   Mode modeSample = Mode::NORMAL;
+  bool spanEncoding = false;
+  mutable bool spansValid = false;
+  mutable std::vector<Span> spans;
+  // Index of each row's first span in `spans`, plus one past the last row
+  mutable std::vector<int32_t> spanRows;
+  // A new version is only drawn from the shared counter once the current one has been seen,
+  // so a loop of SetPixel calls costs one counter increment
+  mutable uint64_t version = 0;
+  mutable bool versionSeen = true;
+  std::vector<uint64_t> rowVersions;
+  // Levels 1 and down, current while mipVersion matches version
+  std::vector<std::unique_ptr<Sprite>> mips;
+  uint64_t mipVersion = 0;
 };
 
 class Window
 {
 public:
-  Window(std::string title, unsigned width, unsigned height);
+  // Headless windows (also forced by a non-zero SDL_TEMPLATE_HEADLESS environment variable)
+  // have no SDL_Window and render with the software renderer into an in-memory surface
+  Window(std::string title, unsigned width, unsigned height, bool headless = false);
   ~Window();
 
+  typedef std::function<Pixel(const int x, const int y, const Pixel &src, const Pixel &dst)> PixelModeFunction;
+
+  // Mode::CUSTOM uses the last functor given; without one it falls back to NORMAL
   void SetPixelMode(Pixel::Mode m);
+  void SetPixelMode(PixelModeFunction pixelMode);
+  Pixel::Mode GetPixelMode();
   void Clear(Pixel color = Color::WHITE);
   void DrawRect(SDL_Rect *rect, unsigned char r, unsigned char g, unsigned char b);
   void DrawRect(SDL_Rect rect, unsigned char r, unsigned char g, unsigned char b);
   void DrawRect(SDL_Rect *rect, Pixel color);
   void DrawRect(SDL_Rect rect, Pixel color);
+  void FillRect(SDL_Rect *rect, Pixel color);
+  void FillRect(SDL_Rect rect, Pixel color);
+  void DrawHLine(int32_t x1, int32_t x2, int32_t y, Pixel color);
+  void DrawVLine(int32_t x, int32_t y1, int32_t y2, Pixel color);
+  void FillSpan(int32_t x, int32_t y, int32_t length, Pixel color);
+  void DrawSprite(int32_t x, int32_t y, const Sprite &sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+  void DrawPartialSprite(int32_t x, int32_t y, const Sprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+  // Resizes by any factor, sampling each covered screen pixel at its centre; minified sprites
+  // read from their mip chain when it is built (see Sprite::BuildMips)
+  void DrawScaledSprite(int32_t x, int32_t y, const Sprite &sprite, float scale, uint8_t flip = Sprite::NONE);
+  // Draws `sprite` through `transform`, which maps sprite texels to screen pixels (so a
+  // negative scale flips it). Every screen pixel whose centre lands inside the sprite is
+  // sampled there, from the mip level matching the transform when the chain is built.
+  void DrawSpriteTransformed(const Sprite &sprite, const Affine2D &transform, bool filtered = false);
+  // Indexed sprites are expanded through `palette` (2^bitsPerPixel entries), or their own palette when it is null
+  void DrawSprite(int32_t x, int32_t y, const IndexedSprite &sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE, const Pixel *palette = nullptr);
+  void DrawPartialSprite(int32_t x, int32_t y, const IndexedSprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale = 1, uint8_t flip = Sprite::NONE, const Pixel *palette = nullptr);
+  // Covers the whole screen with `background` at its current scroll, a scanline at a time
+  void DrawBackground(const Background &background);
+  // Draws the objects over what is already on screen, skipping their transparent pixels
+  void DrawObjects(const ObjectLayer &objects);
+  // Composites `objects` (either may be null) over `background` one scanline at a time, so
+  // BEHIND objects show through the background's transparent pixels
+  void DrawLayers(const Background *background, const ObjectLayer *objects);
   void DrawPixel(int32_t x, int32_t y, unsigned char r, unsigned char g, unsigned char b);
   void DrawPixel(int32_t x, int32_t y, Pixel color);
 
+  void DrawString(int32_t x, int32_t y, const std::string &text, Pixel color = Color::WHITE, uint32_t scale = 1);
+
   void SwapBuffers();
+  // Rasterizes anything recorded while tiled first, so the frame is up to date
+  Sprite *GetDrawTarget();
+  // Marks part of the framebuffer as changed, for code that writes through GetDrawTarget directly
+  void Invalidate(SDL_Rect *rect = nullptr);
+  void SetFullRedraw(bool enabled);
+  // Output pixels uploaded by the last present
+  uint32_t GetUploadedPixels();
+
+  // How the frame is scaled into the window at present. INTEGER uses the largest whole multiple
+  // that fits, STRETCH_4_3 the largest size with the frame's height stretched by SCREEN_STRETCH_4_3,
+  // and FIT the largest size with the frame's own aspect. The frame is centred in `area` of the
+  // window, or in the whole window (following its size) when `area` is null. The default is
+  // INTEGER in the top left SCREEN_WIDTH * RESOLUTION_SCALE x SCREEN_HEIGHT * RESOLUTION_SCALE.
+  enum OutputScale { SCALE_INTEGER, SCALE_STRETCH_4_3, SCALE_FIT };
+  void SetOutputScale(OutputScale mode, const SDL_Rect *area = nullptr);
+  OutputScale GetOutputScale();
+  // Where the last present put the frame, in window pixels
+  SDL_Rect GetOutputRect();
+
+  // While batching, DrawRect/FillRect are deferred and drawn by the renderer over the framebuffer at EndFrame
+  void SetBatching(bool enabled);
+  bool GetBatching();
+  uint32_t GetSDLCallsSaved();
+
+  // While tiled, drawing is recorded and rasterized per screen tile on the WorkerPool at EndFrame.
+  // Sprites (and palettes) passed to DrawSprite must stay alive and unchanged until then (or until GetDrawTarget),
+  // and custom pixel modes may run on any thread.
+  void SetTiledRendering(bool enabled);
+  bool GetTiledRendering();
+
+  // Scanline callbacks run before each screen line DrawLayers (and DrawBackground/DrawObjects)
+  // renders, top to bottom, and may change scroll, palettes, objects or layer state for the
+  // lines below. While any are set, those draws happen immediately even when tiled. `line` -1
+  // runs the callback before every line. Callbacks must not add or remove callbacks.
+  typedef std::function<void(int32_t line)> ScanlineCallback;
+  int32_t AddScanlineCallback(ScanlineCallback callback, int32_t line = -1);
+  void RemoveScanlineCallback(int32_t id);
+  void ClearScanlineCallbacks();
+
+  // Draws a sprite with the renderer, over the framebuffer and batched rects at EndFrame, in
+  // screen pixels. Each sprite keeps a cached texture that is uploaded on first use and after
+  // that only gets the rows changed since, so static art is uploaded once. ALPHA and MASK
+  // draw blended, anything else copies. Sprites must stay alive until EndFrame.
+  void DrawCachedSprite(int32_t x, int32_t y, const Sprite &sprite, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+  void DrawPartialCachedSprite(int32_t x, int32_t y, const Sprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale = 1, uint8_t flip = Sprite::NONE);
+  // The up to date cached texture of `sprite`, or null without a renderer
+  SDL_Texture *GetSpriteTexture(const Sprite &sprite);
+  // Frees the cached texture of `sprite`; call it before destroying a sprite that was drawn cached
+  void ReleaseSpriteTexture(const Sprite &sprite);
+  // Frees every cached texture not used in the last `frames` frames
+  void TrimSpriteTextures(uint32_t frames);
+  uint32_t GetSpriteTexturePixels();
+
+  // Copies every finished frame to a FrameCapture that encodes it on its own thread. The frame is read
+  // back from the renderer once everything (batched rects, cached sprites and ImGui) is drawn, and
+  // brought back to SCREEN_WIDTH x SCREEN_HEIGHT by taking one output pixel per screen pixel
+  void StartCapture(const std::string &path, FrameCapture::Format format, unsigned poolSize = 8, unsigned fps = 60);
+  void StopCapture();
+  FrameCapture *GetCapture();
 
   void EndFrame();
   void Update();
@@ -118,6 +385,8 @@ public:
   static void ConstructFontSheet();
 
   SDL_Window *GetSDLWindow();
+  SDL_Surface *GetSDLSurface();
+  bool IsHeadless();
   SDL_Renderer* GetSDLRenderer();
   SDL_Renderer *GetSDLTextureRenderer();
   void SetSDLRenderTarget(SDL_Texture* target);
@@ -132,18 +401,174 @@ public:
   const int resX, resY;
 
 private:
+  struct DrawBatch
+  {
+    enum Kind { OUTLINE, FILL };
+    Kind kind;
+    SDL_BlendMode blend;
+    Pixel color;
+    SDL_Rect bounds;
+    std::vector<SDL_Rect> rects;
+  };
+
+  // Where and how a rasterizer may write; the screen when drawing immediately, one tile when tiled
+  struct RasterContext
+  {
+    SDL_Rect clip;
+    Pixel::Mode mode;
+    const PixelModeFunction *custom;
+    bool markDirty;
+  };
+
+  struct DrawCommand
+  {
+    enum Kind { FILL, SPRITE, SCALED, TRANSFORMED, INDEXED, LAYERS, STRING };
+    Kind kind;
+    Pixel::Mode mode;
+    int32_t custom;
+    SDL_Rect bounds;
+    Pixel color;
+    int32_t x, y;
+    const Sprite *sprite;
+    const IndexedSprite *indexed;
+    const Background *background;
+    const ObjectLayer *objects;
+    const Pixel *palette;
+    SDL_Rect source;
+    uint32_t scale;
+    uint8_t flip;
+  };
+
+  // What a tile's bin holds: the index of a recorded DrawCommand, or (with FILL_ENTRY set) a whole fill,
+  // since most fills and every pixel cost less to draw than a DrawCommand costs to record. A fill is
+  // clipped to the tile and packed into `command` as FILL_ENTRY | mode << 20 | (h - 1) << 15 | (w - 1) << 10 | y << 5 | x,
+  // in pixels from the tile's corner.
+  struct TileEntry
+  {
+    uint32_t command;
+    uint32_t color;
+  };
+
+  struct ScanlineHook
+  {
+    int32_t id;
+    int32_t line;
+    ScanlineCallback callback;
+  };
+
+  struct CachedTexture
+  {
+    SDL_Texture *texture;
+    int32_t width, height;
+    uint64_t version;
+    uint32_t lastFrame;
+  };
+
+  struct TextureDraw
+  {
+    const Sprite *sprite;
+    SDL_Rect source;
+    SDL_Rect bounds;
+    SDL_RendererFlip flip;
+    SDL_BlendMode blend;
+  };
+
+  static const int TILE_SIZE = 32;
+  static const int TILE_COLUMNS = (SCREEN_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+  static const int TILE_ROWS = (SCREEN_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+  void UpdateOutput();
+  void PresentFrameBuffer();
+  void SetScreenTransform(bool enabled);
+  RasterContext ScreenContext();
+  void WriteSpan(const RasterContext &ctx, int32_t x, int32_t y, Pixel color, int32_t count);
+  void WriteRow(const RasterContext &ctx, int32_t x, int32_t y, const Pixel *src, int32_t count);
+  void WriteMask(const RasterContext &ctx, int32_t x, int32_t y, Pixel color, uint64_t mask, int32_t count);
+  void RasterFill(const RasterContext &ctx, SDL_Rect rect, Pixel color);
+  template <class Rows>
+  void RasterRows(const RasterContext &ctx, int32_t x, int32_t y, SDL_Rect src, uint32_t scale, uint8_t flip, Rows &&rows);
+  void RasterSprite(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip);
+  void RasterSpans(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip);
+  void RasterScaled(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, int32_t w, int32_t h, uint8_t flip);
+  void RasterTransformed(const RasterContext &ctx, const Sprite &sprite, const Affine2D &transform, bool filtered);
+  void RasterIndexed(const RasterContext &ctx, int32_t x, int32_t y, const IndexedSprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip, const Pixel *palette);
+  void RasterLayers(const RasterContext &ctx, const Background *background, const ObjectLayer *objects, bool callbacks);
+  void RasterString(const RasterContext &ctx, int32_t x, int32_t y, const char *text, size_t length, Pixel color, uint32_t scale);
+  void SubmitFill(SDL_Rect rect, Pixel color);
+  void Record(DrawCommand &cmd);
+  void RasterTile(uint32_t tile);
+  void FlushTiles();
+  void MarkDirty(int32_t x, int32_t y, int32_t count);
+  void QueueRect(DrawBatch::Kind kind, SDL_Rect rect, Pixel color);
+  void FlushBatches();
+  void FlushTextureDraws();
+  void ClearSpriteTextures();
+  void CaptureFrame();
+
   static Window* mainWindow;
   SDL_Window *sdlWindow = nullptr;
+  SDL_Surface *sdlSurface = nullptr;
   SDL_Renderer* sdlRenderer = nullptr;
   SDL_Renderer *sdlTextureRenderer = nullptr;
   SDL_Texture* sdlRTarget = nullptr;
   SDL_Texture *sdlRTextureTarget = nullptr;
+  SDL_Texture *sdlFrameTexture = nullptr;
+  Sprite *pFrameBuffer = nullptr;
   static uint8_t count;
   static Sprite *fontSprite;
+  static uint8_t fontGlyphs[96][8];
   bool midFrame;
+  bool headless;
   int id = -1;
 
-  Pixel::Mode nPixelMode;
+  bool fullRedraw = false;
+  int32_t dirtyMinX[SCREEN_HEIGHT];
+  int32_t dirtyMaxX[SCREEN_HEIGHT];
+  uint32_t uploadedPixels = 0;
+
+  OutputScale outputScale = SCALE_INTEGER;
+  bool outputFollowsWindow = false;
+  SDL_Rect outputArea = { 0, 0, SCREEN_WIDTH * RESOLUTION_SCALE, SCREEN_HEIGHT * RESOLUTION_SCALE };
+  SDL_Rect outputRect = { 0, 0, 0, 0 };
+  // Source column of every output column, and the first output row of every source row
+  std::vector<int32_t> outputColumns;
+  int32_t outputRows[SCREEN_HEIGHT + 1];
+  std::vector<Pixel> outputPixels;
+
+  Pixel::Mode nPixelMode = Pixel::Mode::NORMAL;
+  PixelModeFunction funcPixelMode;
+
+  bool batching = false;
+  std::vector<DrawBatch> batches;
+  size_t batchCount = 0;
+  uint32_t batchedCommands = 0;
+  uint32_t sdlCallsSaved = 0;
+
+  std::unordered_map<const Sprite *, CachedTexture> spriteTextures;
+  std::vector<TextureDraw> textureDraws;
+  uint32_t frameNumber = 0;
+  uint32_t spriteTexturePixels = 0;
+
+  FrameCapture *capture = nullptr;
+  // The composited output as read back, and the screen sized frame taken from it
+  std::vector<Pixel> captureOutput;
+  std::vector<Pixel> captureFrame;
+
+  bool tiled = false;
+  // Commands are stored once per frame and each tile's bin lists the ones touching it, in order
+  static const uint32_t FILL_ENTRY = 0x80000000u;
+  std::vector<DrawCommand> recordedDraws;
+  std::vector<std::vector<TileEntry>> tileBins;
+  uint32_t recordedCommands = 0;
+  std::vector<uint32_t> activeTiles;
+  std::vector<PixelModeFunction> recordedModes;
+  int32_t recordedMode = -1;
+  std::string recordedText;
+  std::vector<Affine2D> recordedTransforms;
+  std::vector<const ObjectLayer *> recordedObjects;
+
+  std::vector<ScanlineHook> scanlineHooks;
+  int32_t nextScanlineHook = 0;
 
   static std::vector<Window*> windows;
 
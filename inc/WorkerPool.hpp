@@ -0,0 +1,46 @@
+#ifndef __WORKERPOOL_HPP
+#define __WORKERPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief A fixed set of worker threads fed from one task queue
+///
+/// The queue lock is only taken to hand out tasks; ParallelFor distributes
+/// its indices with an atomic counter so jobs never contend on it.
+class WorkerPool
+{
+public:
+  /// \brief Starts `threads` workers, or one less than the hardware thread count when 0
+  WorkerPool(unsigned threads = 0);
+  ~WorkerPool();
+
+  /// \brief Runs `job(i)` for every i in [0, count) and returns once all have finished
+  ///
+  /// The calling thread works through indices too, so this is safe to call from a worker.
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)> &job);
+  /// \brief Queues `task` to run on a worker
+  std::future<void> Submit(std::function<void()> task);
+
+  unsigned GetThreadCount();
+
+  /// \brief The pool shared by the framework
+  static WorkerPool &Get();
+
+private:
+  void WorkerLoop();
+
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> tasks;
+  std::mutex tasksLocked;
+  std::condition_variable tasksReady;
+  bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#define __AFFINE2D_CPP
+
+#include <cmath>
+
+#include "Affine2D.hpp"
+
+#undef __AFFINE2D_CPP
+
+Affine2D::Affine2D() {}
+
+Affine2D::Affine2D(float a, float b, float tx, float c, float d, float ty)
+  : a(a), b(b), tx(tx), c(c), d(d), ty(ty)
+{
+}
+
+Affine2D Affine2D::Translation(float x, float y)
+{
+  return Affine2D(1.0f, 0.0f, x, 0.0f, 1.0f, y);
+}
+
+Affine2D Affine2D::Rotation(float radians)
+{
+  const float cs = std::cos(radians), sn = std::sin(radians);
+  return Affine2D(cs, sn, 0.0f, -sn, cs, 0.0f);
+}
+
+Affine2D Affine2D::Scale(float sx, float sy)
+{
+  return Affine2D(sx, 0.0f, 0.0f, 0.0f, sy, 0.0f);
+}
+
+Affine2D Affine2D::Place(float x, float y, float radians, float scale, float cx, float cy)
+{
+  return Translation(x, y) * Rotation(radians) * Scale(scale, scale) * Translation(-cx, -cy);
+}
+
+Affine2D Affine2D::operator*(const Affine2D &o) const
+{
+  return Affine2D(a * o.a + b * o.c, a * o.b + b * o.d, a * o.tx + b * o.ty + tx,
+                  c * o.a + d * o.c, c * o.b + d * o.d, c * o.tx + d * o.ty + ty);
+}
+
+float Affine2D::Determinant() const
+{
+  return a * d - b * c;
+}
+
+bool Affine2D::Invert(Affine2D &out) const
+{
+  const double det = double(a) * d - double(b) * c;
+  if (det == 0.0 || !std::isfinite(det))
+    return false;
+  const double ia = d / det, ib = -b / det, ic = -c / det, id = a / det;
+  out = Affine2D(float(ia), float(ib), float(-(ia * tx + ib * ty)), float(ic), float(id), float(-(ic * tx + id * ty)));
+  return true;
+}
+
+void Affine2D::Apply(float x, float y, float &outX, float &outY) const
+{
+  outX = a * x + b * y + tx;
+  outY = c * x + d * y + ty;
+}
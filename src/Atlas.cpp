@@ -0,0 +1,301 @@
+#define __ATLAS_CPP
+
+#include <algorithm>
+
+#include "Atlas.hpp"
+#include "Debug.hpp"
+#include "PixelOps.hpp"
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#pragma warning(push, 0)
+#include <imstb_rectpack.h>
+#pragma warning(pop)
+
+#undef __ATLAS_CPP
+
+struct Atlas::Page
+{
+  Page(int32_t w, int32_t h, int32_t padding)
+    : nodes(size_t(w + padding)), pixels(w, h)
+  {
+    PixelOps::Fill(pixels.GetData(), Color::BLANK, w * h);
+    // The packer's area has padding added on the right and bottom, so a sprite
+    // can sit against the page edge while its padding hangs off it
+    stbrp_init_target(&context, w + padding, h + padding, nodes.data(), int(nodes.size()));
+  }
+
+  void Touch(SDL_Rect rect)
+  {
+    if (dirty.w == 0 || dirty.h == 0)
+      dirty = rect;
+    else
+      SDL_UnionRect(&dirty, &rect, &dirty);
+  }
+
+  stbrp_context context;
+  std::vector<stbrp_node> nodes;
+  Sprite pixels;
+  SDL_Texture *texture = nullptr;
+  SDL_Rect dirty = { 0, 0, 0, 0 };
+  int64_t used = 0;
+};
+
+Atlas::Atlas(SDL_Renderer *renderer, int32_t pageWidth, int32_t pageHeight, int32_t padding)
+  : renderer(renderer), pageWidth(pageWidth), pageHeight(pageHeight), padding(std::max<int32_t>(padding, 0))
+{
+  // stb_rect_pack stores coordinates as 16 bit
+  if (pageWidth <= 0 || pageHeight <= 0 || pageWidth + this->padding > 0xFFFF || pageHeight + this->padding > 0xFFFF)
+  {
+    Debug::LogError("Atlas pages of " + std::to_string(pageWidth) + "x" + std::to_string(pageHeight) + " are not supported");
+    this->pageWidth = this->pageHeight = 1024;
+  }
+}
+
+Atlas::~Atlas()
+{
+  for (auto &page : pages)
+    if (page->texture)
+      SDL_DestroyTexture(page->texture);
+}
+
+Atlas::Handle Atlas::Insert(const Sprite &sprite)
+{
+  return Insert(sprite, { 0, 0, sprite.GetWidth(), sprite.GetHeight() });
+}
+
+Atlas::Handle Atlas::Insert(const Sprite &sprite, SDL_Rect src)
+{
+  SDL_Rect bounds = { 0, 0, sprite.GetWidth(), sprite.GetHeight() };
+  if (!SDL_IntersectRect(&src, &bounds, &src))
+  {
+    Debug::LogError("Cannot add an empty sprite to an atlas");
+    return INVALID;
+  }
+  if (src.w > pageWidth || src.h > pageHeight)
+  {
+    Debug::LogError("A " + std::to_string(src.w) + "x" + std::to_string(src.h) + " sprite does not fit on a " +
+      std::to_string(pageWidth) + "x" + std::to_string(pageHeight) + " atlas page");
+    return INVALID;
+  }
+
+  stbrp_rect rect = {};
+  rect.w = stbrp_coord(src.w + padding);
+  rect.h = stbrp_coord(src.h + padding);
+  // Packing a single rectangle leaves the page untouched when it does not fit, so every page can be tried in turn
+  int32_t index = 0;
+  for (; index < int32_t(pages.size()); index++)
+    if (stbrp_pack_rects(&pages[index]->context, &rect, 1))
+      break;
+  if (index == int32_t(pages.size()))
+  {
+    Page *page = AddPage();
+    stbrp_pack_rects(&page->context, &rect, 1);
+  }
+
+  Page &page = *pages[index];
+  Blit(page, rect.x, rect.y, sprite.GetData() + src.y * sprite.GetWidth() + src.x, sprite.GetWidth(), src.w, src.h);
+  page.used += int64_t(rect.w) * rect.h;
+
+  Handle handle;
+  if (freeHandles.empty())
+  {
+    handle = Handle(entries.size());
+    entries.emplace_back();
+  }
+  else
+  {
+    handle = freeHandles.back();
+    freeHandles.pop_back();
+  }
+  entries[handle] = { index, { rect.x, rect.y, src.w, src.h }, true };
+  return handle;
+}
+
+bool Atlas::Remove(Handle handle)
+{
+  if (!Contains(handle))
+    return false;
+  Entry &entry = entries[handle];
+  Page &page = *pages[entry.page];
+  page.used -= int64_t(entry.rect.w + padding) * (entry.rect.h + padding);
+  // The skyline can't give back space in the middle, but an empty page can start over
+  if (page.used == 0)
+  {
+    stbrp_init_target(&page.context, pageWidth + padding, pageHeight + padding, page.nodes.data(), int(page.nodes.size()));
+    PixelOps::Fill(page.pixels.GetData(), Color::BLANK, pageWidth * pageHeight);
+    page.Touch({ 0, 0, pageWidth, pageHeight });
+  }
+  entry.live = false;
+  freeHandles.push_back(handle);
+  return true;
+}
+
+bool Atlas::Contains(Handle handle) const
+{
+  return handle < entries.size() && entries[handle].live;
+}
+
+Atlas::Region Atlas::Get(Handle handle)
+{
+  if (!Contains(handle))
+    return { nullptr, -1, { 0, 0, 0, 0 } };
+  const Entry &entry = entries[handle];
+  Page &page = *pages[entry.page];
+  UploadPage(page);
+  return { page.texture, entry.page, entry.rect };
+}
+
+bool Atlas::Draw(Handle handle, const SDL_Rect &dst, SDL_RendererFlip flip)
+{
+  const Region region = Get(handle);
+  if (!region.texture)
+    return false;
+  return SDL_RenderCopyEx(renderer, region.texture, &region.rect, &dst, 0.0, nullptr, flip) == 0;
+}
+
+int32_t Atlas::Defragment()
+{
+  std::vector<stbrp_rect> remaining;
+  for (Handle handle = 0; handle < entries.size(); handle++)
+  {
+    if (!entries[handle].live)
+      continue;
+    stbrp_rect rect = {};
+    rect.id = int(handle);
+    rect.w = stbrp_coord(entries[handle].rect.w + padding);
+    rect.h = stbrp_coord(entries[handle].rect.h + padding);
+    remaining.push_back(rect);
+  }
+
+  // Packing everything in one call lets the packer place the tallest sprites first;
+  // whatever doesn't fit moves on to the next page. Every sprite fits an empty page,
+  // so each pass places at least one.
+  std::vector<std::unique_ptr<Page>> packed;
+  while (!remaining.empty())
+  {
+    packed.emplace_back(new Page(pageWidth, pageHeight, padding));
+    Page &page = *packed.back();
+    const int32_t index = int32_t(packed.size()) - 1;
+    stbrp_pack_rects(&page.context, remaining.data(), int(remaining.size()));
+    std::vector<stbrp_rect> left;
+    for (const stbrp_rect &rect : remaining)
+    {
+      if (!rect.was_packed)
+      {
+        left.push_back(rect);
+        continue;
+      }
+      Entry &entry = entries[rect.id];
+      const Sprite &from = pages[entry.page]->pixels;
+      Blit(page, rect.x, rect.y, from.GetData() + entry.rect.y * pageWidth + entry.rect.x, pageWidth, entry.rect.w, entry.rect.h);
+      page.used += int64_t(rect.w) * rect.h;
+      entry.page = index;
+      entry.rect.x = rect.x;
+      entry.rect.y = rect.y;
+    }
+    remaining.swap(left);
+  }
+
+  // Hand the old textures to the new pages, uploaded whole so no old sprite is left in the padding
+  const int32_t released = int32_t(pages.size()) - int32_t(packed.size());
+  for (size_t i = 0; i < pages.size(); i++)
+  {
+    if (i < packed.size())
+    {
+      packed[i]->texture = pages[i]->texture;
+      packed[i]->Touch({ 0, 0, pageWidth, pageHeight });
+    }
+    else if (pages[i]->texture)
+      SDL_DestroyTexture(pages[i]->texture);
+  }
+  for (size_t i = pages.size(); i < packed.size(); i++)
+    packed[i]->texture = CreateTexture();
+  pages.swap(packed);
+  return released;
+}
+
+void Atlas::Upload()
+{
+  for (auto &page : pages)
+    UploadPage(*page);
+}
+
+int32_t Atlas::GetPageCount() const
+{
+  return int32_t(pages.size());
+}
+
+SDL_Texture *Atlas::GetPage(int32_t page)
+{
+  if (page < 0 || page >= int32_t(pages.size()))
+    return nullptr;
+  UploadPage(*pages[page]);
+  return pages[page]->texture;
+}
+
+const Sprite &Atlas::GetPagePixels(int32_t page) const
+{
+  return pages[page]->pixels;
+}
+
+int32_t Atlas::GetPageWidth() const
+{
+  return pageWidth;
+}
+
+int32_t Atlas::GetPageHeight() const
+{
+  return pageHeight;
+}
+
+float Atlas::GetOccupancy() const
+{
+  if (pages.empty())
+    return 0.0f;
+  int64_t used = 0;
+  for (auto &page : pages)
+    used += page->used;
+  return float(double(used) / (double(pageWidth) * pageHeight * pages.size()));
+}
+
+Atlas::Page *Atlas::AddPage()
+{
+  pages.emplace_back(new Page(pageWidth, pageHeight, padding));
+  pages.back()->texture = CreateTexture();
+  return pages.back().get();
+}
+
+SDL_Texture *Atlas::CreateTexture()
+{
+  if (!renderer)
+    return nullptr;
+  SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, pageWidth, pageHeight);
+  if (!texture)
+  {
+    Debug::LogError(std::string("Could not create atlas page! SDL_Error: ") + std::string(SDL_GetError()));
+    return nullptr;
+  }
+  SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  return texture;
+}
+
+void Atlas::Blit(Page &page, int32_t x, int32_t y, const Pixel *src, int32_t pitch, int32_t w, int32_t h)
+{
+  Pixel *dst = page.pixels.GetData() + y * pageWidth + x;
+  for (int32_t row = 0; row < h; row++)
+    PixelOps::Copy(dst + row * pageWidth, src + row * pitch, w);
+  page.Touch({ x, y, w, h });
+}
+
+void Atlas::UploadPage(Page &page)
+{
+  if (page.dirty.w == 0 || page.dirty.h == 0)
+    return;
+  if (page.texture)
+  {
+    const Pixel *src = page.pixels.GetData() + page.dirty.y * pageWidth + page.dirty.x;
+    if (SDL_UpdateTexture(page.texture, &page.dirty, src, pageWidth * int(sizeof(Pixel))))
+      Debug::LogError(std::string("Could not upload atlas page! SDL_Error: ") + std::string(SDL_GetError()));
+  }
+  page.dirty = { 0, 0, 0, 0 };
+}
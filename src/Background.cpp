@@ -0,0 +1,127 @@
+#define __BACKGROUND_CPP
+
+#include <algorithm>
+
+#include "Background.hpp"
+#include "PatternTable.hpp"
+#include "PixelOps.hpp"
+
+#undef __BACKGROUND_CPP
+
+Background::Background()
+{
+}
+
+Background::Background(const PatternTable *patterns, int32_t columns, int32_t rows)
+  : patterns(patterns)
+{
+  Resize(columns, rows);
+}
+
+void Background::Resize(int32_t c, int32_t r)
+{
+  if (c <= 0 || r <= 0)
+    c = r = 0;
+  columns = c;
+  rows = r;
+  cells.assign(size_t(columns) * rows, Cell{ 0, 0, Sprite::NONE });
+}
+
+void Background::SetPatterns(const PatternTable *table)
+{
+  patterns = table;
+}
+
+const PatternTable *Background::GetPatterns() const
+{
+  return patterns;
+}
+
+Background::Cell Background::GetCell(int32_t column, int32_t row) const
+{
+  if (column < 0 || column >= columns || row < 0 || row >= rows)
+    return Cell{ 0, 0, Sprite::NONE };
+  return cells[size_t(row) * columns + column];
+}
+
+bool Background::SetCell(int32_t column, int32_t row, Cell cell)
+{
+  if (column < 0 || column >= columns || row < 0 || row >= rows)
+    return false;
+  cells[size_t(row) * columns + column] = cell;
+  return true;
+}
+
+bool Background::SetCell(int32_t column, int32_t row, uint16_t tile, uint8_t palette, uint8_t flip)
+{
+  return SetCell(column, row, Cell{ tile, palette, flip });
+}
+
+void Background::SetScroll(int32_t x, int32_t y)
+{
+  scrollX = x;
+  scrollY = y;
+}
+
+int32_t Background::GetScrollX() const
+{
+  return scrollX;
+}
+
+int32_t Background::GetScrollY() const
+{
+  return scrollY;
+}
+
+void Background::RenderRow(int32_t y, int32_t x, int32_t count, Pixel *out) const
+{
+  if (!patterns || columns == 0)
+  {
+    PixelOps::Fill(out, Color::BLANK, count);
+    return;
+  }
+  const int32_t size = PatternTable::TILE_SIZE;
+  const int32_t width = columns * size, height = rows * size;
+  // Wrap into the grid; the remainder of a negative number is negative too
+  int32_t wy = int32_t((int64_t(y) + scrollY) % height);
+  if (wy < 0)
+    wy += height;
+  int32_t wx = int32_t((int64_t(x) + scrollX) % width);
+  if (wx < 0)
+    wx += width;
+  const Cell *row = cells.data() + size_t(wy / size) * columns;
+  const int32_t fineY = wy % size;
+  int32_t column = wx / size, fineX = wx % size;
+  while (count > 0)
+  {
+    // One tile row at a time: whatever is left of the current tile, then whole tiles
+    const int32_t n = std::min(size - fineX, count);
+    const Cell &cell = row[column];
+    patterns->ExpandRow(cell.tile, fineY, fineX, n, cell.flip, patterns->GetPalette(cell.palette), out);
+    out += n;
+    count -= n;
+    fineX = 0;
+    if (++column == columns)
+      column = 0;
+  }
+}
+
+int32_t Background::GetColumns() const
+{
+  return columns;
+}
+
+int32_t Background::GetRows() const
+{
+  return rows;
+}
+
+int32_t Background::GetWidth() const
+{
+  return columns * PatternTable::TILE_SIZE;
+}
+
+int32_t Background::GetHeight() const
+{
+  return rows * PatternTable::TILE_SIZE;
+}
@@ -0,0 +1,145 @@
+#define __FRAMECAPTURE_CPP
+
+#include "FrameCapture.hpp"
+#include "Debug.hpp"
+#include "Image.hpp"
+#include "Window.hpp"
+
+#undef __FRAMECAPTURE_CPP
+
+#include <algorithm>
+#include <cstring>
+
+FrameCapture::FrameCapture(const std::string &path, Format format, int32_t width, int32_t height, unsigned poolSize, unsigned fps)
+  : path(path), format(format), width(width), height(height), fps(fps)
+{
+  buffers.resize(std::max(poolSize, 1u));
+  for (size_t i = 0; i < buffers.size(); ++i)
+  {
+    buffers[i].resize(size_t(width) * size_t(height));
+    freeBuffers.push_back(i);
+  }
+  if (format == Format::Y4M || format == Format::RGBA)
+  {
+    stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!stream)
+      Debug::LogError("Could not open capture stream " + path);
+    else if (format == Format::Y4M)
+      stream << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444\n";
+  }
+  writer = std::thread(&FrameCapture::WriterLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+  {
+    std::lock_guard<std::mutex> lock(buffersLocked);
+    stopping = true;
+  }
+  frameQueued.notify_one();
+  writer.join();
+}
+
+bool FrameCapture::Submit(const Pixel *frame)
+{
+  size_t buffer;
+  {
+    std::lock_guard<std::mutex> lock(buffersLocked);
+    if (freeBuffers.empty())
+    {
+      ++dropped;
+      return false;
+    }
+    buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+  }
+  // The copy happens outside the lock, the writer can't see this buffer yet
+  std::memcpy(buffers[buffer].data(), frame, buffers[buffer].size() * sizeof(Pixel));
+  {
+    std::lock_guard<std::mutex> lock(buffersLocked);
+    queuedBuffers.push_back(buffer);
+  }
+  frameQueued.notify_one();
+  return true;
+}
+
+uint32_t FrameCapture::GetWritten()
+{
+  std::lock_guard<std::mutex> lock(buffersLocked);
+  return written;
+}
+
+uint32_t FrameCapture::GetDropped()
+{
+  std::lock_guard<std::mutex> lock(buffersLocked);
+  return dropped;
+}
+
+void FrameCapture::WriterLoop()
+{
+  for (;;)
+  {
+    size_t buffer;
+    {
+      std::unique_lock<std::mutex> lock(buffersLocked);
+      frameQueued.wait(lock, [this] { return stopping || !queuedBuffers.empty(); });
+      if (queuedBuffers.empty())
+        return;
+      buffer = queuedBuffers.front();
+      queuedBuffers.pop_front();
+    }
+    Write(buffers[buffer]);
+    std::lock_guard<std::mutex> lock(buffersLocked);
+    freeBuffers.push_back(buffer);
+    ++written;
+  }
+}
+
+void FrameCapture::Write(const std::vector<Pixel> &frame)
+{
+  encoded.clear();
+  switch (format)
+  {
+  case Format::QOI:
+  case Format::PNG:
+  {
+    std::string index = std::to_string(written);
+    std::string name = path + "_" + std::string(index.size() < 6 ? 6 - index.size() : 0, '0') + index;
+    if (format == Format::QOI)
+    {
+      Image::EncodeQOI(frame.data(), width, height, encoded);
+      name += ".qoi";
+    }
+    else
+    {
+      Image::EncodePNG(frame.data(), width, height, encoded);
+      name += ".png";
+    }
+    std::ofstream file(name, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+    if (!file)
+      Debug::LogError("Could not write capture frame " + name);
+    break;
+  }
+  case Format::Y4M:
+  {
+    // BT.601 studio range, one full resolution plane per component
+    const size_t count = frame.size();
+    encoded.resize(6 + count * 3);
+    std::memcpy(encoded.data(), "FRAME\n", 6);
+    uint8_t *y = encoded.data() + 6, *u = y + count, *v = u + count;
+    for (size_t i = 0; i < count; i++)
+    {
+      const int r = frame[i].r, g = frame[i].g, b = frame[i].b;
+      y[i] = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+      u[i] = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+      v[i] = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+    stream.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+    break;
+  }
+  case Format::RGBA:
+    stream.write(reinterpret_cast<const char *>(frame.data()), frame.size() * sizeof(Pixel));
+    break;
+  }
+}
@@ -0,0 +1,1001 @@
+#define __IMAGE_CPP
+
+#include "Debug.hpp"
+#include "Image.hpp"
+#include "PixelOps.hpp"
+#include "Window.hpp"
+
+#undef __IMAGE_CPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace Image
+{
+namespace
+{
+const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+void PutU32BE(std::vector<uint8_t> &out, uint32_t v)
+{
+  out.push_back(uint8_t(v >> 24));
+  out.push_back(uint8_t(v >> 16));
+  out.push_back(uint8_t(v >> 8));
+  out.push_back(uint8_t(v));
+}
+
+uint32_t Crc32(const uint8_t *data, size_t length, uint32_t crc = 0)
+{
+  static uint32_t table[256];
+  static bool built = false;
+  if (!built)
+  {
+    for (uint32_t n = 0; n < 256; n++)
+    {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    built = true;
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+void PutChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t length)
+{
+  PutU32BE(out, uint32_t(length));
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + length);
+  PutU32BE(out, Crc32(out.data() + start, length + 4));
+}
+} // namespace
+
+void EncodeQOI(const Pixel *pixels, int32_t width, int32_t height, std::vector<uint8_t> &out)
+{
+  out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+  PutU32BE(out, uint32_t(width));
+  PutU32BE(out, uint32_t(height));
+  out.push_back(4); // RGBA
+  out.push_back(0); // sRGB
+  Pixel index[64];
+  std::fill(index, index + 64, Pixel(0, 0, 0, 0));
+  Pixel prev(0, 0, 0, 255);
+  int run = 0;
+  const size_t count = size_t(width) * size_t(height);
+  for (size_t i = 0; i < count; i++)
+  {
+    const Pixel p = pixels[i];
+    if (p == prev)
+    {
+      if (++run == 62 || i + 1 == count)
+      {
+        out.push_back(uint8_t(0xC0 | (run - 1)));
+        run = 0;
+      }
+      continue;
+    }
+    if (run)
+    {
+      out.push_back(uint8_t(0xC0 | (run - 1)));
+      run = 0;
+    }
+    const int hash = (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+    if (index[hash] == p)
+      out.push_back(uint8_t(hash));
+    else
+    {
+      index[hash] = p;
+      if (p.a == prev.a)
+      {
+        const int8_t dr = int8_t(p.r - prev.r), dg = int8_t(p.g - prev.g), db = int8_t(p.b - prev.b);
+        const int8_t drg = int8_t(dr - dg), dbg = int8_t(db - dg);
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+          out.push_back(uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+        else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+        {
+          out.push_back(uint8_t(0x80 | (dg + 32)));
+          out.push_back(uint8_t((drg + 8) << 4 | (dbg + 8)));
+        }
+        else
+          out.insert(out.end(), { 0xFE, p.r, p.g, p.b });
+      }
+      else
+        out.insert(out.end(), { 0xFF, p.r, p.g, p.b, p.a });
+    }
+    prev = p;
+  }
+  out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+}
+
+void EncodePNG(const Pixel *pixels, int32_t width, int32_t height, std::vector<uint8_t> &out)
+{
+  out.insert(out.end(), PNG_SIGNATURE, PNG_SIGNATURE + 8);
+
+  std::vector<uint8_t> header;
+  PutU32BE(header, uint32_t(width));
+  PutU32BE(header, uint32_t(height));
+  header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, deflate, no filter, no interlace
+  PutChunk(out, "IHDR", header.data(), header.size());
+
+  // Each scanline is a filter byte (0, none) followed by the raw row
+  const size_t rowBytes = size_t(width) * 4 + 1;
+  std::vector<uint8_t> raw(rowBytes * size_t(height));
+  for (int32_t y = 0; y < height; y++)
+  {
+    raw[y * rowBytes] = 0;
+    std::memcpy(&raw[y * rowBytes + 1], pixels + size_t(y) * width, size_t(width) * 4);
+  }
+
+  std::vector<uint8_t> zlib;
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  uint32_t a = 1, b = 0;
+  size_t offset = 0;
+  do
+  {
+    const size_t length = std::min<size_t>(raw.size() - offset, 65535);
+    zlib.push_back(offset + length == raw.size() ? 1 : 0);
+    zlib.push_back(uint8_t(length));
+    zlib.push_back(uint8_t(length >> 8));
+    zlib.push_back(uint8_t(~length));
+    zlib.push_back(uint8_t(~length >> 8));
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    for (size_t i = offset; i < offset + length; i++)
+    {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    offset += length;
+  } while (offset < raw.size());
+  PutU32BE(zlib, b << 16 | a);
+  PutChunk(out, "IDAT", zlib.data(), zlib.size());
+  PutChunk(out, "IEND", nullptr, 0);
+}
+
+namespace
+{
+const int32_t MAX_DIMENSION = 1 << 15;
+// Per-thread decode scratch larger than this is handed back after use rather than kept for the next image
+const size_t MAX_KEPT_SCRATCH = 1 << 20;
+
+uint32_t GetU32BE(const uint8_t *p)
+{
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+uint32_t GetU32LE(const uint8_t *p)
+{
+  return uint32_t(p[3]) << 24 | uint32_t(p[2]) << 16 | uint32_t(p[1]) << 8 | p[0];
+}
+
+uint16_t GetU16LE(const uint8_t *p)
+{
+  return uint16_t(p[1] << 8 | p[0]);
+}
+
+uint32_t Reverse(uint32_t code, int bits)
+{
+  uint32_t r = 0;
+  for (int i = 0; i < bits; i++, code >>= 1)
+    r = r << 1 | (code & 1);
+  return r;
+}
+
+/////////////////////////////////////////////////////
+// Inflate (RFC 1950/1951)
+
+// Reads the deflate stream straight out of the (possibly several) mapped IDAT chunks
+struct BitReader
+{
+  const std::vector<std::pair<const uint8_t *, size_t>> &segments;
+  size_t segment = 0;
+  const uint8_t *pos = nullptr;
+  const uint8_t *end = nullptr;
+  uint64_t bits = 0;
+  int count = 0;
+  int padding = 0;
+
+  BitReader(const std::vector<std::pair<const uint8_t *, size_t>> &segments) : segments(segments)
+  {
+    if (!segments.empty())
+    {
+      pos = segments[0].first;
+      end = pos + segments[0].second;
+    }
+  }
+
+  void Refill()
+  {
+    while (count <= 56)
+    {
+      while (pos == end && segment + 1 < segments.size())
+      {
+        ++segment;
+        pos = segments[segment].first;
+        end = pos + segments[segment].second;
+      }
+      // Past the end, feed zeros and remember how many so Overran can tell
+      if (pos == end)
+        ++padding;
+      else
+        bits |= uint64_t(*pos++) << count;
+      count += 8;
+    }
+  }
+
+  uint32_t Get(int n)
+  {
+    if (count < n)
+      Refill();
+    uint32_t v = uint32_t(bits & ((uint64_t(1) << n) - 1));
+    bits >>= n;
+    count -= n;
+    return v;
+  }
+
+  void AlignToByte()
+  {
+    bits >>= count & 7;
+    count &= ~7;
+  }
+
+  // Copies whole bytes after AlignToByte, first from the bit buffer and then straight from the input
+  bool CopyBytes(uint8_t *dst, size_t n)
+  {
+    for (; n && count >= 8; --n)
+      *dst++ = uint8_t(Get(8));
+    while (n)
+    {
+      while (pos == end && segment + 1 < segments.size())
+      {
+        ++segment;
+        pos = segments[segment].first;
+        end = pos + segments[segment].second;
+      }
+      size_t length = std::min<size_t>(n, size_t(end - pos));
+      if (!length)
+        return false;
+      std::memcpy(dst, pos, length);
+      dst += length;
+      pos += length;
+      n -= length;
+    }
+    return true;
+  }
+
+  bool Overran() const
+  {
+    return padding * 8 > count;
+  }
+};
+
+const int FAST_BITS = 9;
+
+struct Huffman
+{
+  uint16_t fast[1 << FAST_BITS]; // length << 9 | symbol for codes of at most FAST_BITS bits, 0 otherwise
+  uint16_t firstCode[16];
+  uint16_t firstSymbol[16];
+  uint32_t maxCode[17];
+  uint16_t symbols[288];
+
+  bool Build(const uint8_t *lengths, int n)
+  {
+    int sizes[16] = { 0 };
+    std::memset(fast, 0, sizeof(fast));
+    for (int i = 0; i < n; i++)
+      sizes[lengths[i]]++;
+    sizes[0] = 0;
+    uint32_t nextCode[16];
+    uint32_t code = 0;
+    int k = 0;
+    for (int i = 1; i < 16; i++)
+    {
+      nextCode[i] = code;
+      firstCode[i] = uint16_t(code);
+      firstSymbol[i] = uint16_t(k);
+      code += sizes[i];
+      if (code > (1u << i))
+        return false;
+      maxCode[i] = code << (16 - i);
+      code <<= 1;
+      k += sizes[i];
+    }
+    maxCode[16] = 0x10000;
+    for (int i = 0; i < n; i++)
+    {
+      const int length = lengths[i];
+      if (!length)
+        continue;
+      symbols[nextCode[length] - firstCode[length] + firstSymbol[length]] = uint16_t(i);
+      if (length <= FAST_BITS)
+        for (uint32_t r = Reverse(nextCode[length], length); r < (1u << FAST_BITS); r += 1u << length)
+          fast[r] = uint16_t(length << 9 | i);
+      nextCode[length]++;
+    }
+    return true;
+  }
+
+  int Decode(BitReader &in) const
+  {
+    if (in.count < 16)
+      in.Refill();
+    const uint16_t entry = fast[in.bits & ((1 << FAST_BITS) - 1)];
+    if (entry)
+    {
+      in.bits >>= entry >> 9;
+      in.count -= entry >> 9;
+      return entry & 511;
+    }
+    const uint32_t k = Reverse(uint32_t(in.bits & 0xFFFF), 16);
+    int s = FAST_BITS + 1;
+    while (k >= maxCode[s])
+      s++;
+    if (s == 16)
+      return -1;
+    in.bits >>= s;
+    in.count -= s;
+    return symbols[(k >> (16 - s)) - firstCode[s] + firstSymbol[s]];
+  }
+};
+
+const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+bool ReadDynamicTables(BitReader &in, Huffman &literals, Huffman &distances)
+{
+  static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+  const int literalCount = int(in.Get(5)) + 257;
+  const int distanceCount = int(in.Get(5)) + 1;
+  const int lengthCount = int(in.Get(4)) + 4;
+  if (literalCount > 286 || distanceCount > 30)
+    return false;
+  uint8_t codeLengths[19] = { 0 };
+  for (int i = 0; i < lengthCount; i++)
+    codeLengths[order[i]] = uint8_t(in.Get(3));
+  Huffman lengthCodes;
+  if (!lengthCodes.Build(codeLengths, 19))
+    return false;
+
+  uint8_t lengths[286 + 30];
+  int n = 0;
+  while (n < literalCount + distanceCount)
+  {
+    int symbol = lengthCodes.Decode(in);
+    if (symbol < 0)
+      return false;
+    if (symbol < 16)
+    {
+      lengths[n++] = uint8_t(symbol);
+      continue;
+    }
+    uint8_t value = 0;
+    int repeat;
+    if (symbol == 16)
+    {
+      if (n == 0)
+        return false;
+      value = lengths[n - 1];
+      repeat = 3 + int(in.Get(2));
+    }
+    else if (symbol == 17)
+      repeat = 3 + int(in.Get(3));
+    else
+      repeat = 11 + int(in.Get(7));
+    if (n + repeat > literalCount + distanceCount)
+      return false;
+    std::memset(lengths + n, value, size_t(repeat));
+    n += repeat;
+  }
+  return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+}
+
+// Inflates a zlib stream into exactly `size` bytes at `out`
+bool Inflate(BitReader &in, uint8_t *out, size_t size)
+{
+  const uint32_t cmf = in.Get(8), flags = in.Get(8);
+  if ((cmf & 0x0F) != 8 || (cmf << 8 | flags) % 31 != 0 || (flags & 0x20))
+    return false;
+
+  static const struct FixedTables
+  {
+    Huffman literals, distances;
+    FixedTables()
+    {
+      uint8_t lengths[288];
+      std::memset(lengths, 8, 144);
+      std::memset(lengths + 144, 9, 112);
+      std::memset(lengths + 256, 7, 24);
+      std::memset(lengths + 280, 8, 8);
+      literals.Build(lengths, 288);
+      std::memset(lengths, 5, 30);
+      distances.Build(lengths, 30);
+    }
+  } fixed;
+
+  Huffman dynamicLiterals, dynamicDistances;
+  size_t o = 0;
+  bool last;
+  do
+  {
+    last = in.Get(1) != 0;
+    const uint32_t type = in.Get(2);
+    if (type == 0)
+    {
+      in.AlignToByte();
+      const uint32_t length = in.Get(16), inverse = in.Get(16);
+      if ((length ^ 0xFFFF) != inverse || o + length > size || !in.CopyBytes(out + o, length))
+        return false;
+      o += length;
+      continue;
+    }
+    const Huffman *literals = &fixed.literals, *distances = &fixed.distances;
+    if (type == 2)
+    {
+      if (!ReadDynamicTables(in, dynamicLiterals, dynamicDistances))
+        return false;
+      literals = &dynamicLiterals;
+      distances = &dynamicDistances;
+    }
+    else if (type != 1)
+      return false;
+
+    for (;;)
+    {
+      int symbol = literals->Decode(in);
+      if (symbol < 256)
+      {
+        if (symbol < 0 || o == size)
+          return false;
+        out[o++] = uint8_t(symbol);
+        continue;
+      }
+      if (symbol == 256)
+        break;
+      symbol -= 257;
+      if (symbol >= 29)
+        return false;
+      const size_t length = LENGTH_BASE[symbol] + in.Get(LENGTH_EXTRA[symbol]);
+      symbol = distances->Decode(in);
+      if (symbol < 0 || symbol >= 30)
+        return false;
+      const size_t distance = DISTANCE_BASE[symbol] + in.Get(DISTANCE_EXTRA[symbol]);
+      if (distance > o || o + length > size)
+        return false;
+      const uint8_t *from = out + o - distance;
+      if (distance >= length)
+        std::memcpy(out + o, from, length);
+      else
+        for (size_t i = 0; i < length; i++)
+          out[o + i] = from[i];
+      o += length;
+    }
+    if (in.Overran())
+      return false;
+  } while (!last);
+  return o == size && !in.Overran();
+}
+
+/////////////////////////////////////////////////////
+// PNG
+
+struct PNGHeader
+{
+  int32_t width = 0, height = 0;
+  int depth = 0, colorType = 0, interlace = 0;
+  int channels = 0;
+  Pixel palette[256];
+  bool hasKey = false;
+  uint16_t key[3] = { 0, 0, 0 };
+};
+
+// Unfilters one scanline in place; `prev` is the unfiltered line above, or nullptr for the first line of a pass
+bool Unfilter(uint8_t filter, uint8_t *row, const uint8_t *prev, size_t length, size_t bpp)
+{
+  switch (filter)
+  {
+  case 0:
+    return true;
+  case 1:
+    for (size_t i = bpp; i < length; i++)
+      row[i] = uint8_t(row[i] + row[i - bpp]);
+    return true;
+  case 2:
+    if (prev)
+      for (size_t i = 0; i < length; i++)
+        row[i] = uint8_t(row[i] + prev[i]);
+    return true;
+  case 3:
+    for (size_t i = 0; i < bpp && i < length; i++)
+      row[i] = uint8_t(row[i] + ((prev ? prev[i] : 0) >> 1));
+    if (prev)
+      for (size_t i = bpp; i < length; i++)
+        row[i] = uint8_t(row[i] + ((row[i - bpp] + prev[i]) >> 1));
+    else
+      for (size_t i = bpp; i < length; i++)
+        row[i] = uint8_t(row[i] + (row[i - bpp] >> 1));
+    return true;
+  case 4:
+    // With no line above the predictor is always the left neighbour, which is just Sub
+    if (!prev)
+      return Unfilter(1, row, prev, length, bpp);
+    for (size_t i = 0; i < bpp && i < length; i++)
+      row[i] = uint8_t(row[i] + prev[i]);
+    for (size_t i = bpp; i < length; i++)
+    {
+      const int a = row[i - bpp], b = prev[i], c = prev[i - bpp];
+      const int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+      row[i] = uint8_t(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Converts `count` samples of an unfiltered scanline into Pixels `step` apart
+void ExpandRow(const PNGHeader &png, const uint8_t *row, int32_t count, Pixel *dst, int32_t step)
+{
+  if (png.depth == 8 && png.colorType == 6 && step == 1)
+  {
+    std::memcpy(dst, row, size_t(count) * 4);
+    return;
+  }
+  const int depth = png.depth;
+  const uint32_t maximum = (1u << depth) - 1;
+  // Raw sample c of pixel x at the image's bit depth
+  auto sample = [row, depth, &png](int32_t x, int c) -> uint32_t
+  {
+    const size_t i = size_t(x) * png.channels + c;
+    if (depth == 8)
+      return row[i];
+    if (depth == 16)
+      return uint32_t(row[i * 2]) << 8 | row[i * 2 + 1];
+    const size_t bit = i * depth;
+    return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+  };
+  auto scale = [depth, maximum](uint32_t v) -> uint8_t
+  {
+    return depth == 16 ? uint8_t(v >> 8) : depth == 8 ? uint8_t(v) : uint8_t(v * 255 / maximum);
+  };
+  for (int32_t x = 0; x < count; x++, dst += step)
+  {
+    switch (png.colorType)
+    {
+    case 0:
+    {
+      const uint32_t g = sample(x, 0);
+      const uint8_t v = scale(g);
+      *dst = Pixel(v, v, v, png.hasKey && g == png.key[0] ? 0 : 255);
+      break;
+    }
+    case 2:
+    {
+      const uint32_t r = sample(x, 0), g = sample(x, 1), b = sample(x, 2);
+      const bool keyed = png.hasKey && r == png.key[0] && g == png.key[1] && b == png.key[2];
+      *dst = Pixel(scale(r), scale(g), scale(b), keyed ? 0 : 255);
+      break;
+    }
+    case 3:
+      *dst = png.palette[sample(x, 0)];
+      break;
+    case 4:
+    {
+      const uint8_t v = scale(sample(x, 0));
+      *dst = Pixel(v, v, v, scale(sample(x, 1)));
+      break;
+    }
+    default:
+      *dst = Pixel(scale(sample(x, 0)), scale(sample(x, 1)), scale(sample(x, 2)), scale(sample(x, 3)));
+      break;
+    }
+  }
+}
+
+bool DecodePNG(const uint8_t *data, size_t size, Pixel *pixels)
+{
+  PNGHeader png;
+  std::fill(png.palette, png.palette + 256, Pixel(0, 0, 0, 255));
+  std::vector<std::pair<const uint8_t *, size_t>> idat;
+  bool ended = false;
+  for (size_t offset = 8; !ended && offset + 12 <= size;)
+  {
+    const uint32_t length = GetU32BE(data + offset);
+    const uint8_t *type = data + offset + 4, *chunk = data + offset + 8;
+    if (length > size - offset - 12)
+    {
+      Debug::LogError("PNG chunk runs past the end of the file");
+      return false;
+    }
+    const bool first = offset == 8;
+    offset += size_t(length) + 12;
+    if (std::memcmp(type, "IHDR", 4) == 0)
+    {
+      // Probe sized the output from the leading IHDR; any other is malformed
+      if (!first || length < 13)
+      {
+        Debug::LogError("PNG has a misplaced IHDR chunk");
+        return false;
+      }
+      png.width = int32_t(GetU32BE(chunk));
+      png.height = int32_t(GetU32BE(chunk + 4));
+      png.depth = chunk[8];
+      png.colorType = chunk[9];
+      png.interlace = chunk[12];
+    }
+    else if (std::memcmp(type, "PLTE", 4) == 0)
+    {
+      for (uint32_t i = 0; i < length / 3 && i < 256; i++)
+        png.palette[i] = Pixel(chunk[i * 3], chunk[i * 3 + 1], chunk[i * 3 + 2]);
+    }
+    else if (std::memcmp(type, "tRNS", 4) == 0)
+    {
+      if (png.colorType == 3)
+      {
+        for (uint32_t i = 0; i < length && i < 256; i++)
+          png.palette[i].a = chunk[i];
+      }
+      else if (png.colorType == 0 && length >= 2)
+      {
+        png.hasKey = true;
+        png.key[0] = uint16_t(chunk[0] << 8 | chunk[1]);
+      }
+      else if (png.colorType == 2 && length >= 6)
+      {
+        png.hasKey = true;
+        for (int c = 0; c < 3; c++)
+          png.key[c] = uint16_t(chunk[c * 2] << 8 | chunk[c * 2 + 1]);
+      }
+    }
+    else if (std::memcmp(type, "IDAT", 4) == 0)
+      idat.emplace_back(chunk, length);
+    else if (std::memcmp(type, "IEND", 4) == 0)
+      ended = true;
+  }
+
+  static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+  png.channels = png.colorType <= 6 ? channels[png.colorType] : 0;
+  const int d = png.depth;
+  const bool validDepth = png.colorType == 0 ? (d == 1 || d == 2 || d == 4 || d == 8 || d == 16)
+                        : png.colorType == 3 ? (d == 1 || d == 2 || d == 4 || d == 8)
+                        : (d == 8 || d == 16);
+  if (!png.channels || !validDepth || png.interlace > 1)
+  {
+    Debug::LogError("Unsupported PNG color type " + std::to_string(png.colorType) + " at bit depth " + std::to_string(d));
+    return false;
+  }
+
+  // Adam7 passes; a plain image is one pass covering every pixel
+  static const int32_t adam7[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+  static const int32_t single[1][4] = { { 0, 0, 1, 1 } };
+  const int32_t(*passes)[4] = png.interlace ? adam7 : single;
+  const int passCount = png.interlace ? 7 : 1;
+  const size_t bitsPerPixel = size_t(png.channels) * d;
+  const size_t bpp = std::max<size_t>(1, bitsPerPixel / 8);
+
+  size_t total = 0;
+  for (int p = 0; p < passCount; p++)
+  {
+    const int32_t w = (png.width - passes[p][0] + passes[p][2] - 1) / passes[p][2];
+    const int32_t h = (png.height - passes[p][1] + passes[p][3] - 1) / passes[p][3];
+    if (w > 0 && h > 0)
+      total += size_t(h) * (1 + (size_t(w) * bitsPerPixel + 7) / 8);
+  }
+
+  // Filtering needs the whole previous scanline, so the image is inflated into a per-thread scratch buffer.
+  // It is reused across images, but one large image shouldn't keep every loading thread at its size.
+  thread_local std::vector<uint8_t> inflated;
+  struct ScratchRelease
+  {
+    std::vector<uint8_t> &scratch;
+    ~ScratchRelease()
+    {
+      if (scratch.capacity() > MAX_KEPT_SCRATCH)
+        std::vector<uint8_t>().swap(scratch);
+    }
+  } release{ inflated };
+  inflated.resize(total);
+  BitReader in(idat);
+  if (!Inflate(in, inflated.data(), total))
+  {
+    Debug::LogError("PNG image data is corrupt or truncated");
+    return false;
+  }
+
+  uint8_t *line = inflated.data();
+  for (int p = 0; p < passCount; p++)
+  {
+    const int32_t x0 = passes[p][0], y0 = passes[p][1], dx = passes[p][2], dy = passes[p][3];
+    const int32_t w = (png.width - x0 + dx - 1) / dx, h = (png.height - y0 + dy - 1) / dy;
+    if (w <= 0 || h <= 0)
+      continue;
+    const size_t rowBytes = (size_t(w) * bitsPerPixel + 7) / 8;
+    const uint8_t *prev = nullptr;
+    for (int32_t y = 0; y < h; y++, line += rowBytes + 1)
+    {
+      if (!Unfilter(line[0], line + 1, prev, rowBytes, bpp))
+      {
+        Debug::LogError("PNG scanline uses unknown filter " + std::to_string(line[0]));
+        return false;
+      }
+      ExpandRow(png, line + 1, w, pixels + size_t(y0 + y * dy) * png.width + x0, dx);
+      prev = line + 1;
+    }
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////
+// BMP
+
+bool DecodeBMP(const uint8_t *data, size_t size, Pixel *pixels)
+{
+  const uint32_t dataOffset = GetU32LE(data + 10), headerSize = GetU32LE(data + 14);
+  int32_t width, height;
+  uint32_t bitCount, compression = 0, paletteCount = 0;
+  size_t paletteOffset = 14 + headerSize, paletteEntry = 4;
+  uint32_t masks[4] = { 0, 0, 0, 0 };
+  if (headerSize == 12)
+  {
+    width = GetU16LE(data + 18);
+    height = GetU16LE(data + 20);
+    bitCount = GetU16LE(data + 24);
+    paletteEntry = 3;
+  }
+  else
+  {
+    width = int32_t(GetU32LE(data + 18));
+    height = int32_t(GetU32LE(data + 22));
+    bitCount = GetU16LE(data + 28);
+    compression = GetU32LE(data + 30);
+    paletteCount = GetU32LE(data + 46);
+    // BI_BITFIELDS (3) and BI_ALPHABITFIELDS (6) masks sit at the same place whether
+    // they are part of a V4/V5 header or trail a plain 40 byte one
+    if (compression == 3 || compression == 6)
+    {
+      if (size < 14 + 40 + 16)
+        return false;
+      for (int c = 0; c < 4; c++)
+        masks[c] = GetU32LE(data + 54 + c * 4);
+      if (headerSize == 40)
+      {
+        paletteOffset += compression == 6 ? 16 : 12;
+        if (compression == 3)
+          masks[3] = 0;
+      }
+    }
+    else if (compression != 0)
+    {
+      Debug::LogError("Compressed BMPs are not supported");
+      return false;
+    }
+  }
+  // A top-down height is negative, and INT32_MIN has no positive counterpart
+  if (height == INT32_MIN)
+    return false;
+  const bool bottomUp = height > 0;
+  height = std::abs(height);
+
+  if (bitCount <= 8)
+  {
+    if (bitCount != 1 && bitCount != 4 && bitCount != 8)
+      return false;
+    if (paletteCount == 0 || paletteCount > (1u << bitCount))
+      paletteCount = 1u << bitCount;
+    if (paletteOffset + paletteCount * paletteEntry > size)
+      return false;
+  }
+  else if (compression == 0)
+  {
+    if (bitCount == 16)
+    {
+      masks[0] = 0x7C00;
+      masks[1] = 0x03E0;
+      masks[2] = 0x001F;
+    }
+    else if (bitCount == 24 || bitCount == 32)
+    {
+      masks[0] = 0xFF0000;
+      masks[1] = 0x00FF00;
+      masks[2] = 0x0000FF;
+    }
+    else
+      return false;
+  }
+  else if (bitCount != 16 && bitCount != 32)
+    return false;
+
+  const size_t stride = (size_t(width) * bitCount + 31) / 32 * 4;
+  if (dataOffset > size || stride * height > size - dataOffset)
+  {
+    Debug::LogError("BMP pixel data runs past the end of the file");
+    return false;
+  }
+
+  Pixel palette[256];
+  for (uint32_t i = 0; bitCount <= 8 && i < paletteCount; i++)
+  {
+    const uint8_t *entry = data + paletteOffset + i * paletteEntry;
+    palette[i] = Pixel(entry[2], entry[1], entry[0]);
+  }
+
+  // Bitfield channels are shifted down and rescaled to 8 bits
+  int shift[4], bits[4];
+  for (int c = 0; c < 4; c++)
+  {
+    shift[c] = 0;
+    bits[c] = 0;
+    if (!masks[c])
+      continue;
+    while (!((masks[c] >> shift[c]) & 1))
+      shift[c]++;
+    while (bits[c] + shift[c] < 32 && ((masks[c] >> (shift[c] + bits[c])) & 1))
+      bits[c]++;
+  }
+  auto channel = [&](uint32_t v, int c, uint8_t fallback) -> uint8_t
+  {
+    if (!masks[c])
+      return fallback;
+    const uint32_t value = (v & masks[c]) >> shift[c];
+    return bits[c] >= 8 ? uint8_t(value >> (bits[c] - 8)) : uint8_t(value * 255 / ((1u << bits[c]) - 1));
+  };
+
+  for (int32_t y = 0; y < height; y++)
+  {
+    const uint8_t *row = data + dataOffset + stride * size_t(bottomUp ? height - 1 - y : y);
+    Pixel *dst = pixels + size_t(y) * width;
+    switch (bitCount)
+    {
+    case 1:
+    case 4:
+    case 8:
+      for (int32_t x = 0; x < width; x++)
+      {
+        const size_t bit = size_t(x) * bitCount;
+        const uint32_t index = (row[bit >> 3] >> (8 - bitCount - (bit & 7))) & ((1u << bitCount) - 1);
+        dst[x] = index < paletteCount ? palette[index] : Pixel(0, 0, 0);
+      }
+      break;
+    case 24:
+      for (int32_t x = 0; x < width; x++, row += 3)
+        dst[x] = Pixel(row[2], row[1], row[0]);
+      break;
+    default:
+      for (int32_t x = 0; x < width; x++)
+      {
+        const uint32_t v = bitCount == 16 ? GetU16LE(row + x * 2) : GetU32LE(row + x * 4);
+        dst[x] = Pixel(channel(v, 0, 0), channel(v, 1, 0), channel(v, 2, 0), channel(v, 3, 255));
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////
+// QOI
+
+bool DecodeQOI(const uint8_t *data, size_t size, Pixel *pixels, size_t count)
+{
+  Pixel index[64];
+  std::fill(index, index + 64, Pixel(0, 0, 0, 0));
+  Pixel p(0, 0, 0, 255);
+  const uint8_t *in = data + 14, *end = data + size - 8;
+  size_t i = 0;
+  while (i < count)
+  {
+    if (in >= end)
+    {
+      Debug::LogError("QOI image data is truncated");
+      return false;
+    }
+    const uint8_t op = *in++;
+    if (op == 0xFE)
+    {
+      p.r = in[0];
+      p.g = in[1];
+      p.b = in[2];
+      in += 3;
+    }
+    else if (op == 0xFF)
+    {
+      p = Pixel(in[0], in[1], in[2], in[3]);
+      in += 4;
+    }
+    else if ((op >> 6) == 0)
+      p = index[op];
+    else if ((op >> 6) == 1)
+    {
+      p.r = uint8_t(p.r + ((op >> 4) & 3) - 2);
+      p.g = uint8_t(p.g + ((op >> 2) & 3) - 2);
+      p.b = uint8_t(p.b + (op & 3) - 2);
+    }
+    else if ((op >> 6) == 2)
+    {
+      const int dg = (op & 63) - 32, next = *in++;
+      p.r = uint8_t(p.r + dg - 8 + (next >> 4));
+      p.g = uint8_t(p.g + dg);
+      p.b = uint8_t(p.b + dg - 8 + (next & 15));
+    }
+    else
+    {
+      const size_t run = std::min<size_t>((op & 63) + 1, count - i);
+      PixelOps::Fill(pixels + i, p, int32_t(run));
+      i += run;
+      continue;
+    }
+    index[(p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64] = p;
+    pixels[i++] = p;
+  }
+  return true;
+}
+} // namespace
+
+Format Probe(const uint8_t *data, size_t size, int32_t &width, int32_t &height)
+{
+  Format format = UNKNOWN;
+  width = height = 0;
+  if (size >= 33 && std::memcmp(data, PNG_SIGNATURE, 8) == 0 && std::memcmp(data + 12, "IHDR", 4) == 0)
+  {
+    format = PNG;
+    width = int32_t(GetU32BE(data + 16));
+    height = int32_t(GetU32BE(data + 20));
+  }
+  else if (size >= 22 && std::memcmp(data, "qoif", 4) == 0)
+  {
+    format = QOI;
+    width = int32_t(GetU32BE(data + 4));
+    height = int32_t(GetU32BE(data + 8));
+  }
+  else if (size >= 26 && data[0] == 'B' && data[1] == 'M')
+  {
+    const uint32_t headerSize = GetU32LE(data + 14);
+    if (headerSize == 12)
+    {
+      format = BMP;
+      width = GetU16LE(data + 18);
+      height = GetU16LE(data + 20);
+    }
+    else if (headerSize >= 40 && size >= 14 + size_t(headerSize))
+    {
+      format = BMP;
+      width = int32_t(GetU32LE(data + 18));
+      // Negated as 64 bits, since a height of INT32_MIN has no 32 bit absolute value
+      height = int32_t(std::min<int64_t>(std::abs(int64_t(int32_t(GetU32LE(data + 22)))), INT32_MAX));
+    }
+  }
+  if (format != UNKNOWN && (width <= 0 || height <= 0 || width > MAX_DIMENSION || height > MAX_DIMENSION))
+  {
+    width = height = 0;
+    return UNKNOWN;
+  }
+  return format;
+}
+
+bool Decode(const uint8_t *data, size_t size, Pixel *pixels)
+{
+  int32_t width, height;
+  switch (Probe(data, size, width, height))
+  {
+  case BMP:
+    return DecodeBMP(data, size, pixels);
+  case PNG:
+    return DecodePNG(data, size, pixels);
+  case QOI:
+    return DecodeQOI(data, size, pixels, size_t(width) * height);
+  default:
+    Debug::LogError("Not a BMP, PNG or QOI image");
+    return false;
+  }
+}
+} // namespace Image
@@ -0,0 +1,151 @@
+#define __INDEXEDSPRITE_CPP
+
+#include <algorithm>
+
+#include "Debug.hpp"
+#include "IndexedSprite.hpp"
+#include "PixelOps.hpp"
+
+#undef __INDEXEDSPRITE_CPP
+
+IndexedSprite::IndexedSprite()
+{
+  Resize(0, 0, 8);
+}
+
+IndexedSprite::IndexedSprite(int32_t w, int32_t h, uint8_t bitsPerPixel)
+{
+  Resize(w, h, bitsPerPixel);
+}
+
+void IndexedSprite::Resize(int32_t w, int32_t h, uint8_t bitsPerPixel)
+{
+  if (bitsPerPixel != 1 && bitsPerPixel != 2 && bitsPerPixel != 4 && bitsPerPixel != 8)
+  {
+    Debug::LogError("Indexed sprites need 1, 2, 4 or 8 bits per pixel, not " + std::to_string(bitsPerPixel));
+    bitsPerPixel = 8;
+  }
+  if (w <= 0 || h <= 0)
+    w = h = 0;
+  width = w;
+  height = h;
+  bits = bitsPerPixel;
+  pitch = (w * bits + 31) / 32 * 4;
+  // The expansion kernels read a whole 8 byte window at a time, so keep 8 spare bytes at the end
+  indices.assign(size_t(pitch) * h + 8, 0);
+  const int32_t colors = 1 << bits;
+  palette.resize(size_t(colors));
+  for (int32_t i = 0; i < colors; i++)
+  {
+    const uint8_t grey = uint8_t(colors > 1 ? i * 255 / (colors - 1) : 0);
+    palette[i] = Pixel(grey, grey, grey);
+  }
+}
+
+bool IndexedSprite::FromSprite(const Sprite &sprite, uint8_t bitsPerPixel)
+{
+  Resize(sprite.GetWidth(), sprite.GetHeight(), bitsPerPixel);
+  int32_t used = 0;
+  for (int32_t y = 0; y < height; y++)
+  {
+    for (int32_t x = 0; x < width; x++)
+    {
+      const Pixel p = sprite.GetData()[y * width + x];
+      int32_t index = int32_t(std::find(palette.begin(), palette.begin() + used, p) - palette.begin());
+      if (index == used)
+      {
+        if (used == int32_t(palette.size()))
+        {
+          Debug::LogError("Sprite has more than " + std::to_string(palette.size()) + " colors");
+          Resize(0, 0, bitsPerPixel);
+          return false;
+        }
+        palette[used++] = p;
+      }
+      SetIndex(x, y, uint8_t(index));
+    }
+  }
+  return true;
+}
+
+uint8_t IndexedSprite::GetIndex(int32_t x, int32_t y) const
+{
+  if (x < 0 || x >= width || y < 0 || y >= height)
+    return 0;
+  const int32_t bit = x * bits;
+  return uint8_t((indices[size_t(y) * pitch + (bit >> 3)] >> (bit & 7)) & ((1 << bits) - 1));
+}
+
+bool IndexedSprite::SetIndex(int32_t x, int32_t y, uint8_t index)
+{
+  if (x < 0 || x >= width || y < 0 || y >= height)
+    return false;
+  const int32_t bit = x * bits;
+  const uint8_t mask = uint8_t(((1 << bits) - 1) << (bit & 7));
+  uint8_t &b = indices[size_t(y) * pitch + (bit >> 3)];
+  b = uint8_t((b & ~mask) | ((index << (bit & 7)) & mask));
+  return true;
+}
+
+Pixel IndexedSprite::GetPixel(int32_t x, int32_t y) const
+{
+  if (x < 0 || x >= width || y < 0 || y >= height)
+    return Pixel(0, 0, 0, 0);
+  return palette[GetIndex(x, y)];
+}
+
+void IndexedSprite::SetPalette(const Pixel *colors, int32_t count)
+{
+  std::copy(colors, colors + std::min<int32_t>(count, int32_t(palette.size())), palette.begin());
+}
+
+void IndexedSprite::SetPaletteColor(uint8_t index, Pixel color)
+{
+  if (index < palette.size())
+    palette[index] = color;
+}
+
+Pixel IndexedSprite::GetPaletteColor(uint8_t index) const
+{
+  return index < palette.size() ? palette[index] : Pixel(0, 0, 0, 0);
+}
+
+const Pixel *IndexedSprite::GetPalette() const
+{
+  return palette.data();
+}
+
+void IndexedSprite::ExpandRow(int32_t x, int32_t y, int32_t count, Pixel *out, const Pixel *colors) const
+{
+  PixelOps::ExpandIndexed(out, indices.data() + size_t(y) * pitch, x, count, bits, colors ? colors : palette.data());
+}
+
+int32_t IndexedSprite::GetWidth() const
+{
+  return width;
+}
+
+int32_t IndexedSprite::GetHeight() const
+{
+  return height;
+}
+
+uint8_t IndexedSprite::GetBitsPerPixel() const
+{
+  return bits;
+}
+
+int32_t IndexedSprite::GetPitch() const
+{
+  return pitch;
+}
+
+const uint8_t *IndexedSprite::GetData() const
+{
+  return indices.data();
+}
+
+uint8_t *IndexedSprite::GetData()
+{
+  return indices.data();
+}
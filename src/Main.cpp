@@ -14,7 +14,8 @@ public:
     Debug::Log("Starting...");
     Debug::Log("Building fontsheet...");
     Window::ConstructFontSheet();
-    ImGui_ImplSDL2_Init(window.GetSDLWindow());
+    if (!window.IsHeadless())
+      ImGui_ImplSDL2_Init(window.GetSDLWindow());
     // Multi threading mode
 #if MULTITHREAD_MODE
     // Start Drawing
@@ -27,7 +28,8 @@ public:
   ~MainCore()
   {
     Debug::Log("Shutting down...");
-    ImGui_ImplSDL2_Shutdown();
+    if (!window.IsHeadless())
+      ImGui_ImplSDL2_Shutdown();
     // Multi threading mode
 #if MULTITHREAD_MODE
     // Start Drawing
@@ -126,6 +128,12 @@ public:
         }
         ImGui::EndMenu();
       }
+      if (ImGui::BeginMenu("Debug"))
+      {
+        if (ImGui::MenuItem("Fill benchmark"))
+          RunFillBenchmark();
+        ImGui::EndMenu();
+      }
       if (ImGui::BeginMenu("Edit"))
       {
         if (ImGui::MenuItem("Cut"))
@@ -155,6 +163,52 @@ public:
     ImGui::EndMainMenuBar();
   }
   
+  // Draws a particle-like load of small alpha blended fills and pixels, first immediately and then
+  // tiled, and logs the best of a few runs of each: recording is the time spent in the draw calls,
+  // the total also includes rasterizing the tiles
+  void RunFillBenchmark()
+  {
+    const int32_t count = 200000;
+    std::vector<SDL_Rect> rects(count);
+    std::vector<Pixel> colors(count);
+    for (int32_t i = 0; i < count; i++)
+    {
+      rects[i] = { rand() % (SCREEN_WIDTH + 4) - 4, rand() % (SCREEN_HEIGHT + 4) - 4, 4, 4 };
+      colors[i] = Pixel(uint8_t(rand()), uint8_t(rand()), uint8_t(rand()), uint8_t(rand()));
+    }
+    const bool wasTiled = window.GetTiledRendering();
+    const Pixel::Mode mode = window.GetPixelMode();
+    for (int pass = 0; pass < 2; pass++)
+    {
+      long long bestRecord = -1, bestTotal = -1;
+      for (int run = 0; run < 5; run++)
+      {
+        window.SetTiledRendering(pass == 1);
+        window.SetPixelMode(Pixel::Mode::ALPHA);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int32_t i = 0; i < count; i++)
+        {
+          // One in eight is a single pixel
+          if (i % 8)
+            window.FillRect(rects[i], colors[i]);
+          else
+            window.DrawPixel(rects[i].x, rects[i].y, colors[i]);
+        }
+        auto recorded = std::chrono::high_resolution_clock::now();
+        window.SetTiledRendering(false);
+        auto end = std::chrono::high_resolution_clock::now();
+        long long record = std::chrono::duration_cast<std::chrono::microseconds>(recorded - start).count();
+        long long total = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        bestRecord = bestRecord < 0 ? record : std::min(bestRecord, record);
+        bestTotal = bestTotal < 0 ? total : std::min(bestTotal, total);
+      }
+      Debug::Log(std::string(pass ? "Tiled" : "Immediate") + ": " + std::to_string(count) + " fills, recording " +
+                 std::to_string(bestRecord) + "us, total " + std::to_string(bestTotal) + "us");
+    }
+    window.SetPixelMode(mode);
+    window.SetTiledRendering(wasTiled);
+  }
+
   void UpdateImGUI(float dt)
   {
     ImGuiIO& io = ImGui::GetIO();
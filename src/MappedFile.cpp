@@ -0,0 +1,119 @@
+#define __MAPPEDFILE_CPP
+
+#include "Debug.hpp"
+#include "MappedFile.hpp"
+
+#undef __MAPPEDFILE_CPP
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {}
+
+MappedFile::MappedFile(const std::string &path)
+{
+  Open(path);
+}
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+bool MappedFile::Open(const std::string &path)
+{
+  Close();
+#ifdef _WIN32
+  file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    file = nullptr;
+    Debug::LogError("Could not open " + path);
+    return false;
+  }
+  LARGE_INTEGER length;
+  if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+  {
+    Debug::LogError("Could not map empty file " + path);
+    Close();
+    return false;
+  }
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping)
+    data = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!data)
+  {
+    Debug::LogError("Could not map " + path);
+    Close();
+    return false;
+  }
+  size = size_t(length.QuadPart);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    Debug::LogError("Could not open " + path);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    Debug::LogError("Could not map empty file " + path);
+    close(fd);
+    return false;
+  }
+  // The mapping keeps its own reference to the file, so the descriptor isn't needed past this
+  void *view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED)
+  {
+    Debug::LogError("Could not map " + path);
+    return false;
+  }
+  data = static_cast<const uint8_t *>(view);
+  size = size_t(info.st_size);
+#endif
+  return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file)
+    CloseHandle(file);
+  mapping = nullptr;
+  file = nullptr;
+#else
+  if (data)
+    munmap(const_cast<uint8_t *>(data), size);
+#endif
+  data = nullptr;
+  size = 0;
+}
+
+bool MappedFile::IsOpen() const
+{
+  return data != nullptr;
+}
+
+const uint8_t *MappedFile::GetData() const
+{
+  return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+  return size;
+}
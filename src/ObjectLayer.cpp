@@ -0,0 +1,175 @@
+#define __OBJECTLAYER_CPP
+
+#include <algorithm>
+
+#include "ObjectLayer.hpp"
+#include "PatternTable.hpp"
+
+#undef __OBJECTLAYER_CPP
+
+ObjectLayer::ObjectLayer(const PatternTable *patterns, int32_t capacity)
+  : patterns(patterns), objects(size_t(std::min<int32_t>(std::max<int32_t>(capacity, 0), 0x10000)))
+{
+  Clear();
+}
+
+void ObjectLayer::SetPatterns(const PatternTable *table)
+{
+  patterns = table;
+}
+
+const PatternTable *ObjectLayer::GetPatterns() const
+{
+  return patterns;
+}
+
+int32_t ObjectLayer::GetCapacity() const
+{
+  return int32_t(objects.size());
+}
+
+ObjectLayer::Object ObjectLayer::GetObject(int32_t index) const
+{
+  if (index < 0 || index >= int32_t(objects.size()))
+    return Object{ 0, 0, 0, 0, HIDDEN };
+  return objects[index];
+}
+
+bool ObjectLayer::SetObject(int32_t index, const Object &object)
+{
+  if (index < 0 || index >= int32_t(objects.size()))
+    return false;
+  objects[index] = object;
+  evaluated = false;
+  return true;
+}
+
+bool ObjectLayer::SetObject(int32_t index, int32_t x, int32_t y, uint16_t tile, uint8_t palette, uint8_t flags)
+{
+  return SetObject(index, Object{ int16_t(x), int16_t(y), tile, palette, flags });
+}
+
+void ObjectLayer::Clear()
+{
+  std::fill(objects.begin(), objects.end(), Object{ 0, 0, 0, 0, HIDDEN });
+  evaluated = false;
+}
+
+void ObjectLayer::SetLineLimit(int32_t limit)
+{
+  lineLimit = std::max<int32_t>(limit, 0);
+  evaluated = false;
+}
+
+int32_t ObjectLayer::GetLineLimit() const
+{
+  return lineLimit;
+}
+
+void ObjectLayer::Evaluate() const
+{
+  if (evaluated)
+    return;
+  // A counting sort: count the objects kept on each line, turn the counts into
+  // offsets, then place each object on its lines. Objects are visited in table
+  // order both times, so the line limit keeps the same (frontmost) ones.
+  const int32_t size = PatternTable::TILE_SIZE;
+  const int32_t limit = lineLimit > 0 ? lineLimit : int32_t(objects.size());
+  int32_t counts[SCREEN_HEIGHT] = {};
+  dropped = 0;
+  for (const Object &object : objects)
+  {
+    if (object.flags & HIDDEN || object.x <= -size || object.x >= SCREEN_WIDTH)
+      continue;
+    const int32_t y0 = std::max<int32_t>(object.y, 0), y1 = std::min<int32_t>(object.y + size, SCREEN_HEIGHT);
+    for (int32_t y = y0; y < y1; y++)
+    {
+      if (counts[y] < limit)
+        counts[y]++;
+      else
+        dropped++;
+    }
+  }
+  lineStart[0] = 0;
+  for (int32_t y = 0; y < SCREEN_HEIGHT; y++)
+    lineStart[y + 1] = lineStart[y] + counts[y];
+  lineObjects.resize(size_t(lineStart[SCREEN_HEIGHT]));
+  std::fill(counts, counts + SCREEN_HEIGHT, 0);
+  for (int32_t i = 0; i < int32_t(objects.size()); i++)
+  {
+    const Object &object = objects[i];
+    if (object.flags & HIDDEN || object.x <= -size || object.x >= SCREEN_WIDTH)
+      continue;
+    const int32_t y0 = std::max<int32_t>(object.y, 0), y1 = std::min<int32_t>(object.y + size, SCREEN_HEIGHT);
+    for (int32_t y = y0; y < y1; y++)
+      if (lineStart[y] + counts[y] < lineStart[y + 1])
+        lineObjects[lineStart[y] + counts[y]++] = uint16_t(i);
+  }
+  evaluated = true;
+}
+
+const uint16_t *ObjectLayer::GetLine(int32_t y, int32_t &count) const
+{
+  Evaluate();
+  if (y < 0 || y >= SCREEN_HEIGHT)
+  {
+    count = 0;
+    return nullptr;
+  }
+  count = lineStart[y + 1] - lineStart[y];
+  return lineObjects.data() + lineStart[y];
+}
+
+int32_t ObjectLayer::GetDroppedCount() const
+{
+  Evaluate();
+  return dropped;
+}
+
+bool ObjectLayer::RenderRow(int32_t y, int32_t x, int32_t count, Pixel *row) const
+{
+  int32_t n;
+  const uint16_t *line = GetLine(y, n);
+  if (n == 0 || !patterns)
+    return false;
+  count = std::min<int32_t>(count, SCREEN_WIDTH);
+
+  // Front to back, the first object to put an opaque pixel in a column owns it. That
+  // includes BEHIND objects, so like on hardware they also hide the objects behind them.
+  const int32_t size = PatternTable::TILE_SIZE;
+  // Plain words, since a Pixel array would run the Pixel constructor on every element
+  uint32_t colors[SCREEN_WIDTH];
+  uint8_t owner[SCREEN_WIDTH];
+  Pixel pixels[PatternTable::TILE_SIZE];
+  // Both start cleared, as the branchless select below reads the colors of unclaimed columns too
+  std::fill(owner, owner + count, uint8_t(0));
+  std::fill(colors, colors + count, 0u);
+  int32_t lo = count, hi = 0;
+  for (int32_t i = 0; i < n; i++)
+  {
+    const Object &object = objects[line[i]];
+    const int32_t c0 = std::max<int32_t>(object.x - x, 0), c1 = std::min<int32_t>(object.x + size - x, count);
+    if (c0 >= c1)
+      continue;
+    lo = std::min(lo, c0);
+    hi = std::max(hi, c1);
+    patterns->ExpandRow(object.tile, y - object.y, c0 + x - object.x, c1 - c0, object.flags & (Sprite::HORIZ | Sprite::VERT),
+                        patterns->GetPalette(object.palette), pixels);
+    const uint8_t flag = object.flags & BEHIND ? 2 : 1;
+    // Opaque and free is close to a coin toss per pixel, so select rather than branch
+    for (int32_t c = c0; c < c1; c++)
+    {
+      const bool claim = owner[c] == 0 && pixels[c - c0].a != 0;
+      colors[c] = claim ? pixels[c - c0].n : colors[c];
+      owner[c] = claim ? flag : owner[c];
+    }
+  }
+  if (lo >= hi)
+    return false;
+  for (int32_t c = lo; c < hi; c++)
+  {
+    const bool show = owner[c] == 1 || (owner[c] == 2 && row[c].a == 0);
+    row[c].n = show ? colors[c] : row[c].n;
+  }
+  return true;
+}
@@ -0,0 +1,182 @@
+#define __PATTERNTABLE_CPP
+
+#include <algorithm>
+#include <cstring>
+
+#include "Debug.hpp"
+#include "IndexedSprite.hpp"
+#include "PatternTable.hpp"
+#include "PixelOps.hpp"
+
+#undef __PATTERNTABLE_CPP
+
+namespace
+{
+
+// Shifting by a constant each step is far cheaper than a variable shift per pixel
+template <int Bits>
+void DecodeRow(uint64_t packed, int32_t x, int32_t count, bool mirrored, const Pixel *palette, Pixel *out)
+{
+  const uint32_t mask = (1u << Bits) - 1;
+  if (mirrored)
+  {
+    packed >>= (PatternTable::TILE_SIZE - x - count) * Bits;
+    for (int32_t i = count - 1; i >= 0; i--, packed >>= Bits)
+      out[i] = palette[uint32_t(packed) & mask];
+  }
+  else
+  {
+    packed >>= x * Bits;
+    for (int32_t i = 0; i < count; i++, packed >>= Bits)
+      out[i] = palette[uint32_t(packed) & mask];
+  }
+}
+
+}
+
+PatternTable::PatternTable()
+{
+  Resize(0, 2, 1);
+}
+
+PatternTable::PatternTable(int32_t tiles, uint8_t bitsPerPixel, int32_t palettes)
+{
+  Resize(tiles, bitsPerPixel, palettes);
+}
+
+void PatternTable::Resize(int32_t tiles, uint8_t bitsPerPixel, int32_t palettes)
+{
+  if (bitsPerPixel != 1 && bitsPerPixel != 2 && bitsPerPixel != 4 && bitsPerPixel != 8)
+  {
+    Debug::LogError("Pattern tables need 1, 2, 4 or 8 bits per pixel, not " + std::to_string(bitsPerPixel));
+    bitsPerPixel = 2;
+  }
+  tileCount = std::max<int32_t>(tiles, 0);
+  bits = bitsPerPixel;
+  paletteCount = std::max<int32_t>(palettes, 1);
+  // A tile row is `bits` bytes but is always read as 8, so keep 8 spare at the end
+  patterns.assign(size_t(tileCount) * TILE_SIZE * bits + 8, 0);
+  const int32_t size = 1 << bits;
+  colors.resize(size_t(paletteCount) * size);
+  for (int32_t p = 0; p < paletteCount; p++)
+  {
+    for (int32_t i = 0; i < size; i++)
+    {
+      const uint8_t grey = uint8_t(size > 1 ? i * 255 / (size - 1) : 0);
+      colors[size_t(p) * size + i] = i == 0 ? Color::BLANK : Pixel(grey, grey, grey);
+    }
+  }
+}
+
+bool PatternTable::FromSprite(const IndexedSprite &sheet)
+{
+  const int32_t columns = sheet.GetWidth() / TILE_SIZE, rows = sheet.GetHeight() / TILE_SIZE;
+  if (columns == 0 || rows == 0)
+  {
+    Debug::LogError("A " + std::to_string(sheet.GetWidth()) + "x" + std::to_string(sheet.GetHeight()) + " sprite holds no 8x8 tiles");
+    return false;
+  }
+  Resize(columns * rows, sheet.GetBitsPerPixel(), paletteCount);
+  for (int32_t tile = 0; tile < tileCount; tile++)
+    for (int32_t y = 0; y < TILE_SIZE; y++)
+      for (int32_t x = 0; x < TILE_SIZE; x++)
+        SetIndex(tile, x, y, sheet.GetIndex(tile % columns * TILE_SIZE + x, tile / columns * TILE_SIZE + y));
+  SetPalette(0, sheet.GetPalette(), 1 << bits);
+  return true;
+}
+
+uint8_t PatternTable::GetIndex(int32_t tile, int32_t x, int32_t y) const
+{
+  if (tile < 0 || tile >= tileCount || x < 0 || x >= TILE_SIZE || y < 0 || y >= TILE_SIZE)
+    return 0;
+  const int32_t bit = x * bits;
+  return uint8_t((patterns[(size_t(tile) * TILE_SIZE + y) * bits + (bit >> 3)] >> (bit & 7)) & ((1 << bits) - 1));
+}
+
+bool PatternTable::SetIndex(int32_t tile, int32_t x, int32_t y, uint8_t index)
+{
+  if (tile < 0 || tile >= tileCount || x < 0 || x >= TILE_SIZE || y < 0 || y >= TILE_SIZE)
+    return false;
+  const int32_t bit = x * bits;
+  const uint8_t mask = uint8_t(((1 << bits) - 1) << (bit & 7));
+  uint8_t &b = patterns[(size_t(tile) * TILE_SIZE + y) * bits + (bit >> 3)];
+  b = uint8_t((b & ~mask) | ((index << (bit & 7)) & mask));
+  return true;
+}
+
+void PatternTable::SetPalette(int32_t palette, const Pixel *src, int32_t count)
+{
+  if (palette < 0 || palette >= paletteCount)
+    return;
+  const int32_t size = 1 << bits;
+  std::copy(src, src + std::min(count, size), colors.begin() + size_t(palette) * size);
+}
+
+void PatternTable::SetPaletteColor(int32_t palette, uint8_t index, Pixel color)
+{
+  if (palette >= 0 && palette < paletteCount && index < (1 << bits))
+    colors[(size_t(palette) << bits) + index] = color;
+}
+
+Pixel PatternTable::GetPaletteColor(int32_t palette, uint8_t index) const
+{
+  if (palette < 0 || palette >= paletteCount || index >= (1 << bits))
+    return Color::BLANK;
+  return colors[(size_t(palette) << bits) + index];
+}
+
+const Pixel *PatternTable::GetPalette(int32_t palette) const
+{
+  return colors.data() + (size_t(std::min(std::max(palette, 0), paletteCount - 1)) << bits);
+}
+
+void PatternTable::ExpandRow(int32_t tile, int32_t y, int32_t x, int32_t count, uint8_t flip, const Pixel *palette, Pixel *out) const
+{
+  if (tile < 0 || tile >= tileCount)
+  {
+    PixelOps::Fill(out, Color::BLANK, count);
+    return;
+  }
+  if (flip & Sprite::VERT)
+    y = TILE_SIZE - 1 - y;
+  // A tile row is at most 8 bytes, so it decodes from a single word; PixelOps::ExpandIndexed
+  // costs more to set up than these 8 lookups take
+  uint64_t packed;
+  std::memcpy(&packed, patterns.data() + (size_t(tile) * TILE_SIZE + y) * bits, sizeof(packed));
+  switch (bits)
+  {
+  case 1:
+    return DecodeRow<1>(packed, x, count, (flip & Sprite::HORIZ) != 0, palette, out);
+  case 2:
+    return DecodeRow<2>(packed, x, count, (flip & Sprite::HORIZ) != 0, palette, out);
+  case 4:
+    return DecodeRow<4>(packed, x, count, (flip & Sprite::HORIZ) != 0, palette, out);
+  default:
+    return DecodeRow<8>(packed, x, count, (flip & Sprite::HORIZ) != 0, palette, out);
+  }
+}
+
+int32_t PatternTable::GetTileCount() const
+{
+  return tileCount;
+}
+
+uint8_t PatternTable::GetBitsPerPixel() const
+{
+  return bits;
+}
+
+int32_t PatternTable::GetPaletteCount() const
+{
+  return paletteCount;
+}
+
+const uint8_t *PatternTable::GetData() const
+{
+  return patterns.data();
+}
+
+uint8_t *PatternTable::GetData()
+{
+  return patterns.data();
+}
@@ -0,0 +1,874 @@
+#define __PIXELOPS_CPP
+
+#include "PixelOps.hpp"
+#include "Window.hpp"
+
+#undef __PIXELOPS_CPP
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXELOPS_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXELOPS_SSE2 __attribute__((target("sse2")))
+#define PIXELOPS_AVX2 __attribute__((target("avx2")))
+#else
+#define PIXELOPS_SSE2
+#define PIXELOPS_AVX2
+#endif
+#else
+#define PIXELOPS_X86 0
+#endif
+
+namespace PixelOps
+{
+namespace
+{
+struct Features
+{
+  bool sse2 = false;
+  bool avx2 = false;
+
+  Features()
+  {
+#if PIXELOPS_X86
+    sse2 = SDL_HasSSE2() == SDL_TRUE;
+    avx2 = SDL_HasAVX2() == SDL_TRUE;
+#endif
+  }
+};
+
+const Features &CPU()
+{
+  static const Features features;
+  return features;
+}
+
+void FillScalar(Pixel *dst, uint32_t v, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++)
+    dst[i].n = v;
+}
+
+// Rounded t / 255 without a divide, exact for any product of two bytes
+inline uint32_t Div255(uint32_t t)
+{
+  t += 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// The destination alpha is composited as if the source alpha channel were 255,
+// which gives regular source-over coverage
+inline uint32_t BlendScalar(uint32_t s, uint32_t d)
+{
+  uint32_t a = s >> 24;
+  if (a == 255)
+    return s;
+  if (a == 0)
+    return d;
+  uint32_t ia = 255 - a;
+  s |= 0xFF000000;
+  uint32_t out = 0;
+  for (int shift = 0; shift < 32; shift += 8)
+    out |= Div255(((s >> shift) & 0xFF) * a + ((d >> shift) & 0xFF) * ia) << shift;
+  return out;
+}
+
+void FillMaskScalar(Pixel *dst, uint32_t v, uint64_t mask, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++, mask >>= 1)
+    if (mask & 1)
+      dst[i].n = v;
+}
+
+void CopyMaskScalar(Pixel *dst, const Pixel *src, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++)
+    if (src[i].a == 255)
+      dst[i] = src[i];
+}
+
+void BlendScalar(Pixel *dst, const Pixel *src, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++)
+    dst[i].n = BlendScalar(src[i].n, dst[i].n);
+}
+
+void BlendScalar(Pixel *dst, uint32_t s, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++)
+    dst[i].n = BlendScalar(s, dst[i].n);
+}
+
+// The 64 bits of packed indices starting at index `first`
+inline uint64_t IndexWindow(const uint8_t *indices, int32_t first, int bits)
+{
+  const int64_t bit = int64_t(first) * bits;
+  uint64_t window;
+  std::memcpy(&window, indices + (bit >> 3), sizeof(window));
+  return window >> (bit & 7);
+}
+
+void ExpandIndexedScalar(Pixel *dst, const uint8_t *indices, int32_t first, int32_t count, int bits, const Pixel *palette)
+{
+  const uint32_t mask = (1u << bits) - 1;
+  for (int32_t i = 0; i < count; i++)
+  {
+    const int64_t bit = int64_t(first + i) * bits;
+    dst[i] = palette[(indices[bit >> 3] >> (bit & 7)) & mask];
+  }
+}
+
+void Downsample2x2Scalar(Pixel *dst, const Pixel *row0, const Pixel *row1, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++)
+  {
+    const uint8_t *a = &row0[2 * i].r, *b = &row1[2 * i].r;
+    uint8_t *out = &dst[i].r;
+    for (int c = 0; c < 4; c++)
+      out[c] = uint8_t((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+  }
+}
+
+// A line of samples through a texture in 16.16 fixed point texel coordinates.
+// For REPEAT and MIRROR, positions and steps are kept reduced to one period
+// (the texture size, or twice it when mirroring) so a step needs at most one
+// subtraction and the integer part never needs a divide to be folded back in.
+template <Address A>
+struct SampleLine
+{
+  const Pixel *texture;
+  int32_t width, height;
+  int64_t u, v, du, dv;
+  int64_t uPeriod, vPeriod;
+
+  static const bool reduced = A == REPEAT || A == MIRROR;
+
+  SampleLine(const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv)
+    : texture(texture), width(width), height(height), u(u), v(v), du(du), dv(dv),
+      uPeriod((int64_t(width) << 16) * (A == MIRROR ? 2 : 1)), vPeriod((int64_t(height) << 16) * (A == MIRROR ? 2 : 1))
+  {
+    if (reduced)
+    {
+      this->u = Reduce(u, uPeriod);
+      this->v = Reduce(v, vPeriod);
+      this->du = Reduce(du, uPeriod);
+      this->dv = Reduce(dv, vPeriod);
+    }
+  }
+
+  static int64_t Reduce(int64_t t, int64_t period)
+  {
+    t %= period;
+    return t < 0 ? t + period : t;
+  }
+
+  void Advance()
+  {
+    u += du;
+    v += dv;
+    if (reduced)
+    {
+      if (u >= uPeriod)
+        u -= uPeriod;
+      if (v >= vPeriod)
+        v -= vPeriod;
+    }
+  }
+
+  void Skip(int32_t n)
+  {
+    if (reduced)
+    {
+      u = Reduce(u + Reduce(du * n, uPeriod), uPeriod);
+      v = Reduce(v + Reduce(dv * n, vPeriod), vPeriod);
+    }
+    else
+    {
+      u += du * n;
+      v += dv * n;
+    }
+  }
+
+  // Folds a texel coordinate into [0, size); BORDER leaves it for Texel to reject.
+  // Reduced coordinates are at most one past the period, from a bilinear sample's second tap.
+  static int64_t Fold(int64_t t, int32_t size)
+  {
+    switch (A)
+    {
+    case REPEAT:
+      return t == size ? 0 : t;
+    case MIRROR:
+      if (t == 2 * int64_t(size))
+        t = 0;
+      return t < size ? t : 2 * int64_t(size) - 1 - t;
+    case CLAMP:
+      return t < 0 ? 0 : t >= size ? size - 1 : t;
+    default:
+      return t;
+    }
+  }
+
+  uint32_t Texel(int64_t x, int64_t y) const
+  {
+    x = Fold(x, width);
+    y = Fold(y, height);
+    return uint64_t(x) < uint64_t(width) && uint64_t(y) < uint64_t(height) ? texture[y * width + x].n : 0;
+  }
+};
+
+// (a * (256 - f) + b * f) / 256 per channel, rounded; f is 0 to 255
+inline uint32_t LerpScalar(uint32_t a, uint32_t b, uint32_t f)
+{
+  uint32_t out = 0;
+  for (int shift = 0; shift < 32; shift += 8)
+    out |= ((((a >> shift) & 0xFF) * (256 - f) + ((b >> shift) & 0xFF) * f + 128) >> 8) << shift;
+  return out;
+}
+
+template <Address A>
+void SampleNearestScalar(Pixel *dst, SampleLine<A> &line, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++, line.Advance())
+    dst[i].n = line.Texel(line.u >> 16, line.v >> 16);
+}
+
+template <Address A>
+void SampleBilinearScalar(Pixel *dst, SampleLine<A> &line, int32_t count)
+{
+  for (int32_t i = 0; i < count; i++, line.Advance())
+  {
+    const int64_t x = line.u >> 16, y = line.v >> 16;
+    const uint32_t fx = uint32_t(line.u >> 8) & 0xFF, fy = uint32_t(line.v >> 8) & 0xFF;
+    const uint32_t top = LerpScalar(line.Texel(x, y), line.Texel(x + 1, y), fx);
+    const uint32_t bottom = LerpScalar(line.Texel(x, y + 1), line.Texel(x + 1, y + 1), fx);
+    dst[i].n = LerpScalar(top, bottom, fy);
+  }
+}
+
+// Whether every position the SIMD loops will visit fits their 32 bit lanes
+template <Address A>
+bool FitsLanes(const SampleLine<A> &line, int32_t count)
+{
+  if (SampleLine<A>::reduced)
+    return line.uPeriod < (int64_t(1) << 30) && line.vPeriod < (int64_t(1) << 30);
+  const int64_t last = count - 1;
+  const int64_t lo = INT32_MIN, hi = INT32_MAX;
+  return line.u >= lo && line.u <= hi && line.u + line.du * last >= lo && line.u + line.du * last <= hi &&
+         line.v >= lo && line.v <= hi && line.v + line.dv * last >= lo && line.v + line.dv * last <= hi;
+}
+
+#if PIXELOPS_X86
+PIXELOPS_SSE2 void FillSSE2(Pixel *dst, uint32_t v, int32_t count)
+{
+  int32_t i = 0;
+  for (; i < count && (reinterpret_cast<uintptr_t>(dst + i) & 15); i++)
+    dst[i].n = v;
+  const __m128i c = _mm_set1_epi32(int(v));
+  for (; i + 8 <= count; i += 8)
+  {
+    _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), c);
+    _mm_store_si128(reinterpret_cast<__m128i *>(dst + i + 4), c);
+  }
+  for (; i + 4 <= count; i += 4)
+    _mm_store_si128(reinterpret_cast<__m128i *>(dst + i), c);
+  FillScalar(dst + i, v, count - i);
+}
+
+PIXELOPS_AVX2 void FillAVX2(Pixel *dst, uint32_t v, int32_t count)
+{
+  int32_t i = 0;
+  for (; i < count && (reinterpret_cast<uintptr_t>(dst + i) & 31); i++)
+    dst[i].n = v;
+  const __m256i c = _mm256_set1_epi32(int(v));
+  for (; i + 16 <= count; i += 16)
+  {
+    _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i), c);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i + 8), c);
+  }
+  for (; i + 8 <= count; i += 8)
+    _mm256_store_si256(reinterpret_cast<__m256i *>(dst + i), c);
+  FillScalar(dst + i, v, count - i);
+}
+
+// Blends 2 pixels unpacked to 16 bits per channel
+PIXELOPS_SSE2 inline __m128i Blend16SSE2(__m128i s16, __m128i d16, __m128i opaque)
+{
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i full = _mm_set1_epi16(255);
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  s16 = _mm_or_si128(s16, opaque);
+  __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s16, a), _mm_mullo_epi16(d16, _mm_sub_epi16(full, a))), bias);
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+PIXELOPS_SSE2 inline __m128i BlendSSE2(__m128i s, __m128i d)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+  __m128i lo = Blend16SSE2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), opaque);
+  __m128i hi = Blend16SSE2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), opaque);
+  return _mm_packus_epi16(lo, hi);
+}
+
+PIXELOPS_SSE2 void FillMaskSSE2(Pixel *dst, uint32_t v, uint64_t mask, int32_t count)
+{
+  const __m128i c = _mm_set1_epi32(int(v));
+  const __m128i bitsLo = _mm_set_epi32(8, 4, 2, 1);
+  const __m128i bitsHi = _mm_set_epi32(128, 64, 32, 16);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8, mask >>= 8)
+  {
+    if ((mask & 0xFF) == 0)
+      continue;
+    const __m128i b = _mm_set1_epi32(int(mask & 0xFF));
+    __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+    __m128i m = _mm_cmpeq_epi32(_mm_and_si128(b, bitsLo), bitsLo);
+    _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, _mm_loadu_si128(p))));
+    m = _mm_cmpeq_epi32(_mm_and_si128(b, bitsHi), bitsHi);
+    _mm_storeu_si128(p + 1, _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, _mm_loadu_si128(p + 1))));
+  }
+  FillMaskScalar(dst + i, v, mask, count - i);
+}
+
+PIXELOPS_SSE2 void CopyMaskSSE2(Pixel *dst, const Pixel *src, int32_t count)
+{
+  const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+  int32_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + i));
+    __m128i m = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, d)));
+  }
+  CopyMaskScalar(dst + i, src + i, count - i);
+}
+
+PIXELOPS_SSE2 void BlendSSE2(Pixel *dst, const Pixel *src, int32_t count)
+{
+  const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+  const __m128i zero = _mm_setzero_si128();
+  int32_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha));
+    if (opaque == 0xFFFF)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), s);
+      continue;
+    }
+    if (opaque == 0 && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero)) == 0xFFFF)
+      continue;
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), BlendSSE2(s, d));
+  }
+  BlendScalar(dst + i, src + i, count - i);
+}
+
+PIXELOPS_SSE2 void BlendSSE2(Pixel *dst, uint32_t v, int32_t count)
+{
+  const __m128i s = _mm_set1_epi32(int(v));
+  int32_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), BlendSSE2(s, d));
+  }
+  BlendScalar(dst + i, v, count - i);
+}
+
+// Rounded (a * (256 - f) + b * f) / 256 for 4 pixels, f holding one weight per pixel
+PIXELOPS_SSE2 inline __m128i LerpSSE2(__m128i a, __m128i b, __m128i f)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i full = _mm_set1_epi16(256);
+  const __m128i f16 = _mm_or_si128(f, _mm_slli_epi32(f, 16));
+  const __m128i fLo = _mm_unpacklo_epi32(f16, f16), fHi = _mm_unpackhi_epi32(f16, f16);
+  __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_sub_epi16(full, fLo)), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), fLo));
+  __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_sub_epi16(full, fHi)), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), fHi));
+  return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, bias), 8), _mm_srli_epi16(_mm_add_epi16(hi, bias), 8));
+}
+
+// SSE2 has no gather, so the taps are fetched one by one and only the filtering is vectorized
+template <Address A>
+PIXELOPS_SSE2 void SampleBilinearSSE2(Pixel *dst, SampleLine<A> &line, int32_t count)
+{
+  int32_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    alignas(16) uint32_t p00[4], p01[4], p10[4], p11[4], fx[4], fy[4];
+    for (int k = 0; k < 4; k++, line.Advance())
+    {
+      const int64_t x = line.u >> 16, y = line.v >> 16;
+      p00[k] = line.Texel(x, y);
+      p01[k] = line.Texel(x + 1, y);
+      p10[k] = line.Texel(x, y + 1);
+      p11[k] = line.Texel(x + 1, y + 1);
+      fx[k] = uint32_t(line.u >> 8) & 0xFF;
+      fy[k] = uint32_t(line.v >> 8) & 0xFF;
+    }
+    const __m128i wx = _mm_load_si128(reinterpret_cast<const __m128i *>(fx));
+    const __m128i top = LerpSSE2(_mm_load_si128(reinterpret_cast<const __m128i *>(p00)), _mm_load_si128(reinterpret_cast<const __m128i *>(p01)), wx);
+    const __m128i bottom = LerpSSE2(_mm_load_si128(reinterpret_cast<const __m128i *>(p10)), _mm_load_si128(reinterpret_cast<const __m128i *>(p11)), wx);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), LerpSSE2(top, bottom, _mm_load_si128(reinterpret_cast<const __m128i *>(fy))));
+  }
+  SampleBilinearScalar(dst + i, line, count - i);
+}
+
+// Sums the two rows as 16 bit channels, then adds neighbouring pixels by pairing the
+// even and odd ones with 64 bit unpacks
+PIXELOPS_SSE2 void Downsample2x2SSE2(Pixel *dst, const Pixel *row0, const Pixel *row1, int32_t count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(2);
+  int32_t i = 0;
+  for (; i + 2 <= count; i += 2)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * i));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * i));
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(sum, sum));
+  }
+  Downsample2x2Scalar(dst + i, row0 + 2 * i, row1 + 2 * i, count - i);
+}
+
+PIXELOPS_AVX2 inline __m256i Blend16AVX2(__m256i s16, __m256i d16, __m256i opaque)
+{
+  const __m256i bias = _mm256_set1_epi16(128);
+  const __m256i full = _mm256_set1_epi16(255);
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  s16 = _mm256_or_si256(s16, opaque);
+  __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s16, a), _mm256_mullo_epi16(d16, _mm256_sub_epi16(full, a))), bias);
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Unpack and pack both work within 128 bit lanes, so pixel order is preserved
+PIXELOPS_AVX2 inline __m256i BlendAVX2(__m256i s, __m256i d)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i opaque = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+  __m256i lo = Blend16AVX2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero), opaque);
+  __m256i hi = Blend16AVX2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero), opaque);
+  return _mm256_packus_epi16(lo, hi);
+}
+
+PIXELOPS_AVX2 void FillMaskAVX2(Pixel *dst, uint32_t v, uint64_t mask, int32_t count)
+{
+  const __m256i c = _mm256_set1_epi32(int(v));
+  const __m256i bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8, mask >>= 8)
+  {
+    if ((mask & 0xFF) == 0)
+      continue;
+    const __m256i b = _mm256_set1_epi32(int(mask & 0xFF));
+    _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + i), _mm256_cmpeq_epi32(_mm256_and_si256(b, bits), bits), c);
+  }
+  FillMaskScalar(dst + i, v, mask, count - i);
+}
+
+PIXELOPS_AVX2 void CopyMaskAVX2(Pixel *dst, const Pixel *src, int32_t count)
+{
+  const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), alpha);
+    _mm256_maskstore_epi32(reinterpret_cast<int *>(dst + i), m, s);
+  }
+  CopyMaskScalar(dst + i, src + i, count - i);
+}
+
+PIXELOPS_AVX2 void BlendAVX2(Pixel *dst, const Pixel *src, int32_t count)
+{
+  const __m256i alpha = _mm256_set1_epi32(int(0xFF000000));
+  const __m256i zero = _mm256_setzero_si256();
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    __m256i sa = _mm256_and_si256(s, alpha);
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alpha)) == -1)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), s);
+      continue;
+    }
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, zero)) == -1)
+      continue;
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), BlendAVX2(s, d));
+  }
+  BlendScalar(dst + i, src + i, count - i);
+}
+
+PIXELOPS_AVX2 void BlendAVX2(Pixel *dst, uint32_t v, int32_t count)
+{
+  const __m256i s = _mm256_set1_epi32(int(v));
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), BlendAVX2(s, d));
+  }
+  BlendScalar(dst + i, v, count - i);
+}
+
+PIXELOPS_AVX2 inline __m256i LerpAVX2(__m256i a, __m256i b, __m256i f)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bias = _mm256_set1_epi16(128);
+  const __m256i full = _mm256_set1_epi16(256);
+  const __m256i f16 = _mm256_or_si256(f, _mm256_slli_epi32(f, 16));
+  const __m256i fLo = _mm256_unpacklo_epi32(f16, f16), fHi = _mm256_unpackhi_epi32(f16, f16);
+  __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_sub_epi16(full, fLo)), _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), fLo));
+  __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_sub_epi16(full, fHi)), _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), fHi));
+  return _mm256_packus_epi16(_mm256_srli_epi16(_mm256_add_epi16(lo, bias), 8), _mm256_srli_epi16(_mm256_add_epi16(hi, bias), 8));
+}
+
+// Up to 16 palette entries live in two registers and are picked with permutes;
+// 8 bit indices go through a gather from the palette instead
+PIXELOPS_AVX2 void ExpandIndexedAVX2(Pixel *dst, const uint8_t *indices, int32_t first, int32_t count, int bits, const Pixel *palette)
+{
+  alignas(32) Pixel entries[16];
+  if (bits < 8)
+    std::copy(palette, palette + (1 << bits), entries);
+  const __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i *>(entries));
+  const __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i *>(entries + 8));
+  const __m256i shifts = _mm256_mullo_epi32(_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0), _mm256_set1_epi32(bits));
+  const __m256i mask = _mm256_set1_epi32((1 << bits) - 1);
+  const __m256i eight = _mm256_set1_epi32(8);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    const uint64_t window = IndexWindow(indices, first + i, bits);
+    __m256i p;
+    if (bits == 8)
+    {
+      const __m256i index = _mm256_cvtepu8_epi32(_mm_cvtsi32_si128(int(uint32_t(window))));
+      const __m256i index2 = _mm256_cvtepu8_epi32(_mm_cvtsi32_si128(int(uint32_t(window >> 32))));
+      p = _mm256_i32gather_epi32(reinterpret_cast<const int *>(palette), _mm256_permute2x128_si256(index, index2, 0x20), 4);
+    }
+    else
+    {
+      const __m256i index = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(int(uint32_t(window))), shifts), mask);
+      p = _mm256_permutevar8x32_epi32(low, index);
+      if (bits == 4)
+        p = _mm256_blendv_epi8(p, _mm256_permutevar8x32_epi32(high, index), _mm256_cmpeq_epi32(_mm256_and_si256(index, eight), eight));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), p);
+  }
+  ExpandIndexedScalar(dst + i, indices, first + i, count - i, bits, palette);
+}
+
+// The SSE2 pairing within each 128 bit lane, which leaves the 8 results as
+// pixels 0 1 4 5 | 2 3 6 7 until the final permute
+PIXELOPS_AVX2 void Downsample2x2AVX2(Pixel *dst, const Pixel *row0, const Pixel *row1, int32_t count)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i round = _mm256_set1_epi16(2);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256i sums[2];
+    for (int half = 0; half < 2; half++)
+    {
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row0 + 2 * i + 8 * half));
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + 2 * i + 8 * half));
+      const __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+      const __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+      const __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+      sums[half] = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+    }
+    const __m256i packed = _mm256_packus_epi16(sums[0], sums[1]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  Downsample2x2Scalar(dst + i, row0 + 2 * i, row1 + 2 * i, count - i);
+}
+
+// Positions of the next 8 samples, and how far all 8 move per block
+template <Address A>
+struct LanesAVX2
+{
+  __m256i u, v, du, dv, uPeriod, vPeriod;
+
+  PIXELOPS_AVX2 LanesAVX2(const SampleLine<A> &line)
+  {
+    alignas(32) int32_t us[8], vs[8];
+    SampleLine<A> walk = line;
+    for (int k = 0; k < 8; k++, walk.Advance())
+    {
+      us[k] = int32_t(walk.u);
+      vs[k] = int32_t(walk.v);
+    }
+    u = _mm256_load_si256(reinterpret_cast<const __m256i *>(us));
+    v = _mm256_load_si256(reinterpret_cast<const __m256i *>(vs));
+    // Reduced steps stay under one period, so one conditional subtraction keeps the lanes in range
+    const bool reduced = SampleLine<A>::reduced;
+    du = _mm256_set1_epi32(int32_t(reduced ? SampleLine<A>::Reduce(line.du * 8, line.uPeriod) : line.du * 8));
+    dv = _mm256_set1_epi32(int32_t(reduced ? SampleLine<A>::Reduce(line.dv * 8, line.vPeriod) : line.dv * 8));
+    uPeriod = _mm256_set1_epi32(int32_t(line.uPeriod));
+    vPeriod = _mm256_set1_epi32(int32_t(line.vPeriod));
+  }
+
+  PIXELOPS_AVX2 void Advance()
+  {
+    u = _mm256_add_epi32(u, du);
+    v = _mm256_add_epi32(v, dv);
+    if (SampleLine<A>::reduced)
+    {
+      const __m256i one = _mm256_set1_epi32(1);
+      u = _mm256_sub_epi32(u, _mm256_and_si256(_mm256_cmpgt_epi32(u, _mm256_sub_epi32(uPeriod, one)), uPeriod));
+      v = _mm256_sub_epi32(v, _mm256_and_si256(_mm256_cmpgt_epi32(v, _mm256_sub_epi32(vPeriod, one)), vPeriod));
+    }
+  }
+};
+
+// Lanes whose coordinate lies in [0, size)
+PIXELOPS_AVX2 inline __m256i InRangeAVX2(__m256i t, __m256i size)
+{
+  return _mm256_and_si256(_mm256_cmpgt_epi32(t, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(size, t));
+}
+
+// SampleLine::Fold for 8 texel coordinates
+template <Address A>
+PIXELOPS_AVX2 inline __m256i FoldAVX2(__m256i t, __m256i size)
+{
+  const __m256i one = _mm256_set1_epi32(1);
+  switch (A)
+  {
+  case REPEAT:
+    return _mm256_andnot_si256(_mm256_cmpeq_epi32(t, size), t);
+  case MIRROR:
+  {
+    const __m256i period = _mm256_add_epi32(size, size);
+    t = _mm256_andnot_si256(_mm256_cmpeq_epi32(t, period), t);
+    return _mm256_blendv_epi8(t, _mm256_sub_epi32(_mm256_sub_epi32(period, one), t), _mm256_cmpgt_epi32(t, _mm256_sub_epi32(size, one)));
+  }
+  case CLAMP:
+    return _mm256_min_epi32(_mm256_max_epi32(t, _mm256_setzero_si256()), _mm256_sub_epi32(size, one));
+  default:
+    return t;
+  }
+}
+
+// Gathers the texels at (x, y); only BORDER needs the bounds mask, every other mode has already folded them in
+template <Address A>
+PIXELOPS_AVX2 inline __m256i GatherAVX2(const int *texture, __m256i x, __m256i y, __m256i width, __m256i height)
+{
+  const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(y, width), x);
+  if (A != BORDER)
+    return _mm256_i32gather_epi32(texture, index, 4);
+  const __m256i inside = _mm256_and_si256(InRangeAVX2(x, width), InRangeAVX2(y, height));
+  return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), texture, index, inside, 4);
+}
+
+template <Address A>
+PIXELOPS_AVX2 void SampleNearestAVX2(Pixel *dst, SampleLine<A> &line, int32_t count)
+{
+  const int *texture = reinterpret_cast<const int *>(line.texture);
+  const __m256i width = _mm256_set1_epi32(line.width), height = _mm256_set1_epi32(line.height);
+  LanesAVX2<A> lanes(line);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8, lanes.Advance())
+  {
+    const __m256i x = FoldAVX2<A>(_mm256_srai_epi32(lanes.u, 16), width);
+    const __m256i y = FoldAVX2<A>(_mm256_srai_epi32(lanes.v, 16), height);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), GatherAVX2<A>(texture, x, y, width, height));
+  }
+  line.Skip(i);
+  SampleNearestScalar(dst + i, line, count - i);
+}
+
+template <Address A>
+PIXELOPS_AVX2 void SampleBilinearAVX2(Pixel *dst, SampleLine<A> &line, int32_t count)
+{
+  const int *texture = reinterpret_cast<const int *>(line.texture);
+  const __m256i width = _mm256_set1_epi32(line.width), height = _mm256_set1_epi32(line.height);
+  const __m256i one = _mm256_set1_epi32(1), low = _mm256_set1_epi32(0xFF);
+  LanesAVX2<A> lanes(line);
+  int32_t i = 0;
+  for (; i + 8 <= count; i += 8, lanes.Advance())
+  {
+    const __m256i tx = _mm256_srai_epi32(lanes.u, 16), ty = _mm256_srai_epi32(lanes.v, 16);
+    const __m256i x0 = FoldAVX2<A>(tx, width), x1 = FoldAVX2<A>(_mm256_add_epi32(tx, one), width);
+    const __m256i y0 = FoldAVX2<A>(ty, height), y1 = FoldAVX2<A>(_mm256_add_epi32(ty, one), height);
+    const __m256i fx = _mm256_and_si256(_mm256_srli_epi32(lanes.u, 8), low);
+    const __m256i fy = _mm256_and_si256(_mm256_srli_epi32(lanes.v, 8), low);
+    const __m256i top = LerpAVX2(GatherAVX2<A>(texture, x0, y0, width, height), GatherAVX2<A>(texture, x1, y0, width, height), fx);
+    const __m256i bottom = LerpAVX2(GatherAVX2<A>(texture, x0, y1, width, height), GatherAVX2<A>(texture, x1, y1, width, height), fx);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), LerpAVX2(top, bottom, fy));
+  }
+  line.Skip(i);
+  SampleBilinearScalar(dst + i, line, count - i);
+}
+#endif
+
+template <Address A>
+void SampleNearestWith(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count)
+{
+  SampleLine<A> line(texture, width, height, u, v, du, dv);
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2 && FitsLanes(line, count))
+    return SampleNearestAVX2(dst, line, count);
+#endif
+  SampleNearestScalar(dst, line, count);
+}
+
+template <Address A>
+void SampleBilinearWith(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count)
+{
+  SampleLine<A> line(texture, width, height, u, v, du, dv);
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2 && FitsLanes(line, count))
+    return SampleBilinearAVX2(dst, line, count);
+  if (count >= 4 && CPU().sse2)
+    return SampleBilinearSSE2(dst, line, count);
+#endif
+  SampleBilinearScalar(dst, line, count);
+}
+} // namespace
+
+void Fill(Pixel *dst, Pixel color, int32_t count)
+{
+  if (count <= 0)
+    return;
+#if PIXELOPS_X86
+  // Short runs (single pixels, vertical lines) aren't worth the alignment prologue
+  if (count >= 16 && CPU().avx2)
+    return FillAVX2(dst, color.n, count);
+  if (count >= 8 && CPU().sse2)
+    return FillSSE2(dst, color.n, count);
+#endif
+  FillScalar(dst, color.n, count);
+}
+
+void FillMask(Pixel *dst, Pixel color, uint64_t mask, int32_t count)
+{
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return FillMaskAVX2(dst, color.n, mask, count);
+  if (count >= 8 && CPU().sse2)
+    return FillMaskSSE2(dst, color.n, mask, count);
+#endif
+  FillMaskScalar(dst, color.n, mask, count);
+}
+
+void Copy(Pixel *dst, const Pixel *src, int32_t count)
+{
+  if (count > 0)
+    std::memcpy(dst, src, size_t(count) * sizeof(Pixel));
+}
+
+void CopyMask(Pixel *dst, const Pixel *src, int32_t count)
+{
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return CopyMaskAVX2(dst, src, count);
+  if (count >= 4 && CPU().sse2)
+    return CopyMaskSSE2(dst, src, count);
+#endif
+  CopyMaskScalar(dst, src, count);
+}
+
+void BlendAlpha(Pixel *dst, const Pixel *src, int32_t count)
+{
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return BlendAVX2(dst, src, count);
+  if (count >= 4 && CPU().sse2)
+    return BlendSSE2(dst, src, count);
+#endif
+  BlendScalar(dst, src, count);
+}
+
+void BlendAlpha(Pixel *dst, Pixel color, int32_t count)
+{
+  if (color.a == 255)
+    return Fill(dst, color, count);
+  if (color.a == 0)
+    return;
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return BlendAVX2(dst, color.n, count);
+  if (count >= 4 && CPU().sse2)
+    return BlendSSE2(dst, color.n, count);
+#endif
+  BlendScalar(dst, color.n, count);
+}
+
+void ExpandIndexed(Pixel *dst, const uint8_t *indices, int32_t first, int32_t count, int bits, const Pixel *palette)
+{
+  if (count <= 0)
+    return;
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return ExpandIndexedAVX2(dst, indices, first, count, bits, palette);
+#endif
+  ExpandIndexedScalar(dst, indices, first, count, bits, palette);
+}
+
+void Downsample2x2(Pixel *dst, const Pixel *row0, const Pixel *row1, int32_t count)
+{
+  if (count <= 0)
+    return;
+#if PIXELOPS_X86
+  if (count >= 8 && CPU().avx2)
+    return Downsample2x2AVX2(dst, row0, row1, count);
+  if (count >= 2 && CPU().sse2)
+    return Downsample2x2SSE2(dst, row0, row1, count);
+#endif
+  Downsample2x2Scalar(dst, row0, row1, count);
+}
+
+void SampleNearest(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count, Address address)
+{
+  if (count <= 0)
+    return;
+  if (!texture || width <= 0 || height <= 0)
+    return Fill(dst, Pixel(0, 0, 0, 0), count);
+  switch (address)
+  {
+  case BORDER:
+    return SampleNearestWith<BORDER>(dst, texture, width, height, u, v, du, dv, count);
+  case REPEAT:
+    return SampleNearestWith<REPEAT>(dst, texture, width, height, u, v, du, dv, count);
+  case CLAMP:
+    return SampleNearestWith<CLAMP>(dst, texture, width, height, u, v, du, dv, count);
+  case MIRROR:
+    return SampleNearestWith<MIRROR>(dst, texture, width, height, u, v, du, dv, count);
+  }
+}
+
+void SampleBilinear(Pixel *dst, const Pixel *texture, int32_t width, int32_t height, int64_t u, int64_t v, int64_t du, int64_t dv, int32_t count, Address address)
+{
+  if (count <= 0)
+    return;
+  if (!texture || width <= 0 || height <= 0)
+    return Fill(dst, Pixel(0, 0, 0, 0), count);
+  switch (address)
+  {
+  case BORDER:
+    return SampleBilinearWith<BORDER>(dst, texture, width, height, u, v, du, dv, count);
+  case REPEAT:
+    return SampleBilinearWith<REPEAT>(dst, texture, width, height, u, v, du, dv, count);
+  case CLAMP:
+    return SampleBilinearWith<CLAMP>(dst, texture, width, height, u, v, du, dv, count);
+  case MIRROR:
+    return SampleBilinearWith<MIRROR>(dst, texture, width, height, u, v, du, dv, count);
+  }
+}
+
+Pixel BlendAlpha(Pixel src, Pixel dst)
+{
+  return Pixel(BlendScalar(src.n, dst.n));
+}
+} // namespace PixelOps
@@ -0,0 +1,126 @@
+#define __PIXELPOOL_CPP
+
+#include <cstdlib>
+
+#include "PixelPool.hpp"
+#include "Window.hpp"
+
+#undef __PIXELPOOL_CPP
+
+namespace
+{
+void *AlignedAlloc(size_t bytes)
+{
+#ifdef _WIN32
+  return _aligned_malloc(bytes, PixelPool::ALIGNMENT);
+#else
+  void *p = nullptr;
+  return posix_memalign(&p, PixelPool::ALIGNMENT, bytes) == 0 ? p : nullptr;
+#endif
+}
+
+void AlignedFree(void *p)
+{
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+} // namespace
+
+PixelPool::~PixelPool()
+{
+  Trim();
+}
+
+size_t PixelPool::ClassIndex(size_t bytes)
+{
+  if (bytes <= 64)
+    return 0;
+  // bytes - 1 lies in [2^e, 2^(e+1)); round up to the next quarter step above it
+  size_t n = bytes - 1;
+  size_t e = 0;
+  while ((n >> e) > 1)
+    ++e;
+  return (e - 6) * 4 + ((n >> (e - 2)) & 3) + 1;
+}
+
+size_t PixelPool::ClassBytes(size_t index)
+{
+  return size_t(4 + index % 4) << (6 + index / 4 - 2);
+}
+
+bool PixelPool::SameClass(size_t a, size_t b)
+{
+  return ClassIndex(a * sizeof(Pixel)) == ClassIndex(b * sizeof(Pixel));
+}
+
+Pixel *PixelPool::Acquire(size_t count)
+{
+  if (count == 0)
+    return nullptr;
+  const size_t index = ClassIndex(count * sizeof(Pixel));
+  if (index >= CLASS_COUNT)
+    return static_cast<Pixel *>(AlignedAlloc(count * sizeof(Pixel)));
+  {
+    std::lock_guard<std::mutex> lock(listsLocked);
+    std::vector<void *> &list = freeLists[index];
+    if (!list.empty())
+    {
+      void *p = list.back();
+      list.pop_back();
+      cachedBytes -= ClassBytes(index);
+      return static_cast<Pixel *>(p);
+    }
+    ++heapAllocations;
+  }
+  return static_cast<Pixel *>(AlignedAlloc(ClassBytes(index)));
+}
+
+void PixelPool::Release(Pixel *pixels, size_t count)
+{
+  if (!pixels)
+    return;
+  const size_t index = ClassIndex(count * sizeof(Pixel));
+  if (index >= CLASS_COUNT)
+  {
+    AlignedFree(pixels);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(listsLocked);
+  freeLists[index].push_back(pixels);
+  cachedBytes += ClassBytes(index);
+}
+
+void PixelPool::Trim()
+{
+  std::lock_guard<std::mutex> lock(listsLocked);
+  for (std::vector<void *> &list : freeLists)
+  {
+    for (void *p : list)
+      AlignedFree(p);
+    list.clear();
+    list.shrink_to_fit();
+  }
+  cachedBytes = 0;
+}
+
+size_t PixelPool::GetCachedBytes()
+{
+  std::lock_guard<std::mutex> lock(listsLocked);
+  return cachedBytes;
+}
+
+uint64_t PixelPool::GetHeapAllocations()
+{
+  std::lock_guard<std::mutex> lock(listsLocked);
+  return heapAllocations;
+}
+
+PixelPool &PixelPool::Get()
+{
+  // Never destroyed, so sprites with static storage can still release into it at exit
+  static PixelPool *pool = new PixelPool();
+  return *pool;
+}
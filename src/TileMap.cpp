@@ -0,0 +1,277 @@
+#define __TILEMAP_CPP
+
+#include <algorithm>
+#include <chrono>
+
+#include "PatternTable.hpp"
+#include "PixelOps.hpp"
+#include "TileMap.hpp"
+#include "WorkerPool.hpp"
+
+#undef __TILEMAP_CPP
+
+// Everything a chunk render needs, copied out of the map so a worker never reads cells being edited
+struct TileMap::Build
+{
+  const PatternTable *patterns;
+  std::vector<Cell> cells;
+  int32_t columns, rows;
+  uint64_t edits;
+  std::unique_ptr<Sprite> sprite;
+  std::future<void> done;
+
+  void Run()
+  {
+    const int32_t size = PatternTable::TILE_SIZE;
+    const int32_t width = columns * size;
+    sprite.reset(new Sprite(width, rows * size));
+    Pixel *data = sprite->GetData();
+    for (int32_t ty = 0; ty < rows; ty++)
+    {
+      const Cell *row = cells.data() + size_t(ty) * columns;
+      for (int32_t y = 0; y < size; y++)
+      {
+        Pixel *out = data + size_t(ty * size + y) * width;
+        if (!patterns)
+        {
+          PixelOps::Fill(out, Color::BLANK, width);
+          continue;
+        }
+        for (int32_t tx = 0; tx < columns; tx++)
+          patterns->ExpandRow(row[tx].tile, y, 0, size, row[tx].flip, patterns->GetPalette(row[tx].palette), out + tx * size);
+      }
+    }
+    sprite->Invalidate();
+  }
+};
+
+static int32_t FloorDiv(int32_t n, int32_t d)
+{
+  return n / d - (n % d != 0 && n < 0);
+}
+
+TileMap::TileMap(const PatternTable *patterns, int32_t columns, int32_t rows, int32_t chunkTiles)
+  : patterns(patterns), columns(std::max<int32_t>(columns, 0)), rows(std::max<int32_t>(rows, 0)), chunkTiles(std::max<int32_t>(chunkTiles, 1))
+{
+  if (this->columns == 0 || this->rows == 0)
+    this->columns = this->rows = 0;
+  chunkColumns = (this->columns + this->chunkTiles - 1) / this->chunkTiles;
+  chunkRows = (this->rows + this->chunkTiles - 1) / this->chunkTiles;
+  cells.assign(size_t(this->columns) * this->rows, Cell{ 0, 0, Sprite::NONE });
+  chunks.resize(size_t(chunkColumns) * chunkRows);
+}
+
+TileMap::~TileMap()
+{
+  for (Chunk &chunk : chunks)
+    if (chunk.pending && chunk.pending->done.valid())
+      chunk.pending->done.wait();
+}
+
+void TileMap::SetPatterns(const PatternTable *table)
+{
+  patterns = table;
+  Invalidate();
+}
+
+const PatternTable *TileMap::GetPatterns() const
+{
+  return patterns;
+}
+
+TileMap::Cell TileMap::GetCell(int32_t column, int32_t row) const
+{
+  if (column < 0 || column >= columns || row < 0 || row >= rows)
+    return Cell{ 0, 0, Sprite::NONE };
+  return cells[size_t(row) * columns + column];
+}
+
+bool TileMap::SetCell(int32_t column, int32_t row, Cell cell)
+{
+  if (column < 0 || column >= columns || row < 0 || row >= rows)
+    return false;
+  Cell &old = cells[size_t(row) * columns + column];
+  if (old.tile == cell.tile && old.palette == cell.palette && old.flip == cell.flip)
+    return true;
+  old = cell;
+  chunks[size_t(row / chunkTiles) * chunkColumns + column / chunkTiles].edits++;
+  return true;
+}
+
+bool TileMap::SetCell(int32_t column, int32_t row, uint16_t tile, uint8_t palette, uint8_t flip)
+{
+  return SetCell(column, row, Cell{ tile, palette, flip });
+}
+
+void TileMap::Invalidate()
+{
+  for (Chunk &chunk : chunks)
+    chunk.edits++;
+}
+
+void TileMap::Draw(Window &window, int32_t cameraX, int32_t cameraY)
+{
+  frame++;
+  // Sprites replaced before the previous Draw can no longer be referenced by recorded commands
+  retiredBefore.clear();
+  retiredBefore.swap(retired);
+  const int32_t size = GetChunkSize();
+  const int32_t cx0 = std::max(FloorDiv(cameraX, size), 0), cx1 = std::min(FloorDiv(cameraX + SCREEN_WIDTH - 1, size), chunkColumns - 1);
+  const int32_t cy0 = std::max(FloorDiv(cameraY, size), 0), cy1 = std::min(FloorDiv(cameraY + SCREEN_HEIGHT - 1, size), chunkRows - 1);
+  for (int32_t cy = cy0; cy <= cy1; cy++)
+    for (int32_t cx = cx0; cx <= cx1; cx++)
+      window.DrawSprite(cx * size - cameraX, cy * size - cameraY, *GetChunk(cx, cy));
+  Trim();
+}
+
+void TileMap::Prefetch(int32_t cameraX, int32_t cameraY, int32_t margin)
+{
+  const int32_t size = GetChunkSize();
+  margin = std::max<int32_t>(margin, 0);
+  const int32_t cx0 = std::max(FloorDiv(cameraX - margin, size), 0), cx1 = std::min(FloorDiv(cameraX + SCREEN_WIDTH - 1 + margin, size), chunkColumns - 1);
+  const int32_t cy0 = std::max(FloorDiv(cameraY - margin, size), 0), cy1 = std::min(FloorDiv(cameraY + SCREEN_HEIGHT - 1 + margin, size), chunkRows - 1);
+  for (int32_t cy = cy0; cy <= cy1; cy++)
+  {
+    for (int32_t cx = cx0; cx <= cx1; cx++)
+    {
+      const int32_t index = cy * chunkColumns + cx;
+      Chunk &chunk = chunks[index];
+      // Finished renders join the cache (and its budget) as soon as they are noticed
+      if (chunk.pending && chunk.pending->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        Adopt(index);
+      if (chunk.pending || (chunk.sprite && chunk.built == chunk.edits))
+        continue;
+      std::shared_ptr<Build> build = Snapshot(index);
+      build->done = WorkerPool::Get().Submit([build]() { build->Run(); });
+      chunk.pending = build;
+      chunk.lastUse = frame;
+    }
+  }
+  Trim();
+}
+
+const Sprite *TileMap::GetChunk(int32_t chunkX, int32_t chunkY)
+{
+  if (chunkX < 0 || chunkX >= chunkColumns || chunkY < 0 || chunkY >= chunkRows)
+    return nullptr;
+  const int32_t index = chunkY * chunkColumns + chunkX;
+  Chunk &chunk = chunks[index];
+  chunk.lastUse = frame;
+  if (chunk.pending)
+    Adopt(index);
+  if (!chunk.sprite || chunk.built != chunk.edits)
+  {
+    chunk.pending = Snapshot(index);
+    chunk.pending->Run();
+    Adopt(index);
+  }
+  return chunk.sprite.get();
+}
+
+void TileMap::SetBudget(size_t bytes)
+{
+  budget = bytes;
+  Trim();
+}
+
+size_t TileMap::GetBudget() const
+{
+  return budget;
+}
+
+size_t TileMap::GetCachedBytes() const
+{
+  return cachedBytes;
+}
+
+uint32_t TileMap::GetBuildCount() const
+{
+  return builds;
+}
+
+int32_t TileMap::GetColumns() const
+{
+  return columns;
+}
+
+int32_t TileMap::GetRows() const
+{
+  return rows;
+}
+
+int32_t TileMap::GetChunkSize() const
+{
+  return chunkTiles * PatternTable::TILE_SIZE;
+}
+
+int32_t TileMap::GetChunkColumns() const
+{
+  return chunkColumns;
+}
+
+int32_t TileMap::GetChunkRows() const
+{
+  return chunkRows;
+}
+
+std::shared_ptr<TileMap::Build> TileMap::Snapshot(int32_t index) const
+{
+  std::shared_ptr<Build> build = std::make_shared<Build>();
+  const int32_t tx = index % chunkColumns * chunkTiles, ty = index / chunkColumns * chunkTiles;
+  build->patterns = patterns;
+  build->columns = std::min(chunkTiles, columns - tx);
+  build->rows = std::min(chunkTiles, rows - ty);
+  build->edits = chunks[index].edits;
+  build->cells.resize(size_t(build->columns) * build->rows);
+  for (int32_t y = 0; y < build->rows; y++)
+  {
+    const Cell *src = cells.data() + size_t(ty + y) * columns + tx;
+    std::copy(src, src + build->columns, build->cells.begin() + size_t(y) * build->columns);
+  }
+  return build;
+}
+
+void TileMap::Adopt(int32_t index)
+{
+  Chunk &chunk = chunks[index];
+  std::shared_ptr<Build> build = std::move(chunk.pending);
+  if (build->done.valid())
+    build->done.get();
+  builds++;
+  // A cell changed while this was rendering, so it is already stale
+  if (build->edits != chunk.edits)
+    return;
+  if (chunk.sprite)
+  {
+    // A tiled frame may still hold the old sprite, so it outlives the next Draw like Trim's victims would
+    cachedBytes -= size_t(chunk.sprite->GetWidth()) * chunk.sprite->GetHeight() * sizeof(Pixel);
+    retired.push_back(std::move(chunk.sprite));
+  }
+  else
+    cached.push_back(index);
+  chunk.sprite = std::move(build->sprite);
+  chunk.built = build->edits;
+  cachedBytes += size_t(chunk.sprite->GetWidth()) * chunk.sprite->GetHeight() * sizeof(Pixel);
+}
+
+void TileMap::Trim()
+{
+  while (cachedBytes > budget)
+  {
+    // Least recently used first; chunks drawn by this Draw or the previous one may still be referenced by recorded commands
+    size_t oldest = cached.size();
+    for (size_t i = 0; i < cached.size(); i++)
+    {
+      const Chunk &chunk = chunks[cached[i]];
+      if (chunk.lastUse + 1 < frame && (oldest == cached.size() || chunk.lastUse < chunks[cached[oldest]].lastUse))
+        oldest = i;
+    }
+    if (oldest == cached.size())
+      return;
+    Chunk &chunk = chunks[cached[oldest]];
+    cachedBytes -= size_t(chunk.sprite->GetWidth()) * chunk.sprite->GetHeight() * sizeof(Pixel);
+    chunk.sprite.reset();
+    cached[oldest] = cached.back();
+    cached.pop_back();
+  }
+}
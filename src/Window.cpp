@@ -1,10 +1,23 @@
 #define __WINDOW_CPP
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
 
+#include "Background.hpp"
 #include "Debug.hpp"
+#include "Image.hpp"
+#include "IndexedSprite.hpp"
+#include "MappedFile.hpp"
+#include "ObjectLayer.hpp"
+#include "PixelOps.hpp"
+#include "PixelPool.hpp"
 #include "Window.hpp"
+#include "WorkerPool.hpp"
 
 #pragma warning(push, 0)
 #include "imgui.h"
@@ -36,6 +49,15 @@ bool Pixel::operator!=(const Pixel& p) const
 
 /////////////////////////////////////////////////////
 
+namespace
+{
+uint64_t NextVersion()
+{
+  static std::atomic<uint64_t> counter(0);
+  return ++counter;
+}
+} // namespace
+
 Sprite::Sprite() : width(0), height(0), pColData(nullptr) {}
 
 Sprite::Sprite(int32_t w, int32_t h)
@@ -43,32 +65,141 @@ Sprite::Sprite(int32_t w, int32_t h)
   Resize(w, h);
 }
 
+Sprite::Sprite(Sprite &&other) noexcept
+  : width(other.width), height(other.height), pColData(other.pColData), modeSample(other.modeSample),
+    spanEncoding(other.spanEncoding), spansValid(other.spansValid), spans(std::move(other.spans)), spanRows(std::move(other.spanRows)),
+    rowVersions(std::move(other.rowVersions)), mips(std::move(other.mips))
+{
+  other.width = 0;
+  other.height = 0;
+  other.pColData = nullptr;
+  other.spansValid = false;
+  // Whatever was cached for this address before may be newer than the rows moved in
+  const bool valid = spansValid;
+  const bool mipsCurrent = other.mipVersion == other.version;
+  Touch(0, height);
+  spansValid = valid;
+  if (mipsCurrent)
+    mipVersion = GetVersion();
+}
+
 Sprite::~Sprite()
 {
-  if (pColData) delete pColData;
+  PixelPool::Get().Release(pColData, size_t(width) * height);
 }
 
-void Sprite::Resize(int32_t w, int32_t h)
+Sprite &Sprite::operator=(Sprite &&other) noexcept
 {
+  if (this != &other)
+  {
+    PixelPool::Get().Release(pColData, size_t(width) * height);
+    width = other.width;
+    height = other.height;
+    pColData = other.pColData;
+    modeSample = other.modeSample;
+    spanEncoding = other.spanEncoding;
+    spansValid = other.spansValid;
+    spans = std::move(other.spans);
+    spanRows = std::move(other.spanRows);
+    rowVersions = std::move(other.rowVersions);
+    mips = std::move(other.mips);
+    other.width = 0;
+    other.height = 0;
+    other.pColData = nullptr;
+    other.spansValid = false;
+    const bool valid = spansValid;
+    const bool mipsCurrent = other.mipVersion == other.version;
+    versionSeen = true;
+    Touch(0, height);
+    spansValid = valid;
+    mipVersion = mipsCurrent ? GetVersion() : 0;
+  }
+  return *this;
+}
+
+void Sprite::Allocate(int32_t w, int32_t h)
+{
+  if (w <= 0 || h <= 0)
+    w = h = 0;
+  const size_t count = size_t(w) * h;
+  // A buffer of the same size class already fits, so only swap it out when the class changes
+  if (!pColData || !PixelPool::SameClass(size_t(width) * height, count))
+  {
+    PixelPool::Get().Release(pColData, size_t(width) * height);
+    pColData = PixelPool::Get().Acquire(count);
+  }
   width = w;
   height = h;
-  pColData = new Pixel[width * height];
-  for (int32_t i = 0; i < width * height; i++)
-    pColData[i] = Pixel();
+  rowVersions.resize(size_t(h));
+  Touch(0, h);
 }
 
-Pixel Sprite::GetPixel(int32_t x, int32_t y)
+void Sprite::Touch(int32_t y0, int32_t y1)
 {
-  if (modeSample == Sprite::Mode::NORMAL)
+  if (versionSeen)
   {
-    if (x >= 0 && x < width && y >= 0 && y < height)
-      return pColData[y * width + x];
-    else
-      return Pixel(0, 0, 0, 0);
+    version = NextVersion();
+    versionSeen = false;
   }
-  else
+  std::fill(rowVersions.begin() + y0, rowVersions.begin() + y1, version);
+  spansValid = false;
+}
+
+void Sprite::Resize(int32_t w, int32_t h)
+{
+  Allocate(w, h);
+  if (pColData)
+    PixelOps::Fill(pColData, Pixel(), width * height);
+}
+
+bool Sprite::Load(const std::string &path)
+{
+  MappedFile file;
+  int32_t w, h;
+  if (!file.Open(path))
+  {
+    Allocate(0, 0);
+    return false;
+  }
+  if (Image::Probe(file.GetData(), file.GetSize(), w, h) == Image::UNKNOWN)
+  {
+    Debug::LogError("Unrecognised image format in " + path);
+    Allocate(0, 0);
+    return false;
+  }
+  // Every pixel gets decoded, so skip the fill Resize would do
+  Allocate(w, h);
+  if (!Image::Decode(file.GetData(), file.GetSize(), pColData))
+  {
+    Debug::LogError("Could not decode " + path);
+    Allocate(0, 0);
+    return false;
+  }
+  return true;
+}
+
+std::future<bool> Sprite::LoadAsync(const std::string &path)
+{
+  auto result = std::make_shared<std::promise<bool>>();
+  std::future<bool> loaded = result->get_future();
+  WorkerPool::Get().Submit([this, path, result]() { result->set_value(Load(path)); });
+  return loaded;
+}
+
+Pixel Sprite::GetPixel(int32_t x, int32_t y) const
+{
+  if (!pColData)
+    return Pixel(0, 0, 0, 0);
+  switch (modeSample)
   {
-    return pColData[std::abs(y % height) * width + std::abs(x % width)];
+  case Mode::PERIODIC:
+    return Texel<Repeat>(x, y);
+  case Mode::CLAMP:
+    return Texel<Clamp>(x, y);
+  case Mode::MIRROR:
+    return Texel<Mirror>(x, y);
+  default:
+    return Texel<Border>(x, y);
   }
 }
 
@@ -77,53 +208,359 @@ bool  Sprite::SetPixel(int32_t x, int32_t y, Pixel p)
   if (x >= 0 && x < width && y >= 0 && y < height)
   {
     pColData[y*width + x] = p;
+    if (versionSeen)
+      Touch(y, y + 1);
+    else
+      rowVersions[y] = version;
+    spansValid = false;
     return true;
   }
   else
     return false;
 }
 
-Pixel Sprite::Sample(float x, float y)
+Pixel Sprite::Sample(float x, float y, float footprint) const
+{
+  const Sprite &level = GetMip(SelectMip(footprint));
+  return level.GetPixel(std::min((int32_t)((x * (float)level.width)), level.width - 1), std::min((int32_t)((y * (float)level.height)), level.height - 1));
+}
+
+Pixel Sprite::SampleBilinear(float x, float y, float footprint) const
+{
+  Pixel p;
+  GetMip(SelectMip(footprint)).SampleSpanBilinear(x, y, 0.0f, 0.0f, 1, &p);
+  return p;
+}
+
+// Normalized coordinate to 16.16 fixed point texels
+static int64_t ToTexels(float t, int32_t size)
+{
+  return int64_t(std::floor(double(t) * size * 65536.0 + 0.5));
+}
+
+static PixelOps::Address ToAddress(Sprite::Mode mode)
+{
+  switch (mode)
+  {
+  case Sprite::PERIODIC:
+    return PixelOps::REPEAT;
+  case Sprite::CLAMP:
+    return PixelOps::CLAMP;
+  case Sprite::MIRROR:
+    return PixelOps::MIRROR;
+  default:
+    return PixelOps::BORDER;
+  }
+}
+
+void Sprite::SampleSpan(float u0, float v0, float du, float dv, int32_t count, Pixel *out) const
+{
+  const Sprite &level = GetMip(SelectMip(std::max(std::fabs(du) * width, std::fabs(dv) * height)));
+  const int32_t w = level.width, h = level.height;
+  PixelOps::SampleNearest(out, level.pColData, w, h, ToTexels(u0, w), ToTexels(v0, h),
+                          ToTexels(du, w), ToTexels(dv, h), count, ToAddress(modeSample));
+}
+
+void Sprite::SampleSpanBilinear(float u0, float v0, float du, float dv, int32_t count, Pixel *out) const
+{
+  const Sprite &level = GetMip(SelectMip(std::max(std::fabs(du) * width, std::fabs(dv) * height)));
+  const int32_t w = level.width, h = level.height;
+  // Texel centres sit half a texel in from the sprite's edges
+  PixelOps::SampleBilinear(out, level.pColData, w, h, ToTexels(u0, w) - 0x8000, ToTexels(v0, h) - 0x8000,
+                           ToTexels(du, w), ToTexels(dv, h), count, ToAddress(modeSample));
+}
+
+void Sprite::SetSampleMode(Mode mode)
+{
+  modeSample = mode;
+  for (auto &level : mips)
+    level->modeSample = mode;
+}
+
+Sprite::Mode Sprite::GetSampleMode() const
+{
+  return modeSample;
+}
+
+int32_t Sprite::GetWidth() const
+{
+  return width;
+}
+
+int32_t Sprite::GetHeight() const
+{
+  return height;
+}
+
+void Sprite::SetSpanEncoding(bool enabled)
+{
+  spanEncoding = enabled;
+  if (!enabled)
+  {
+    spansValid = false;
+    spans = std::vector<Span>();
+    spanRows = std::vector<int32_t>();
+  }
+}
+
+bool Sprite::GetSpanEncoding() const
+{
+  return spanEncoding;
+}
+
+void Sprite::UpdateSpans() const
+{
+  if (spansValid)
+    return;
+  spans.clear();
+  spanRows.resize(size_t(height) + 1);
+  for (int32_t y = 0; y < height; y++)
+  {
+    spanRows[y] = int32_t(spans.size());
+    const Pixel *row = pColData + y * width;
+    // The mixed span still being extended, until a long transparent or opaque run ends it
+    int32_t open = -1;
+    for (int32_t x = 0; x < width;)
+    {
+      const uint8_t a = row[x].a;
+      const int32_t start = x;
+      if (a == 0 || a == 255)
+        while (x < width && row[x].a == a)
+          x++;
+      else
+        while (x < width && row[x].a != 0 && row[x].a != 255)
+          x++;
+      const int32_t length = x - start;
+      if (a == 0)
+      {
+        if (length >= SPAN_MIN_RUN)
+          open = -1;
+      }
+      else if (a == 255 && length >= SPAN_MIN_RUN)
+      {
+        spans.push_back({ start, length, true });
+        open = -1;
+      }
+      else if (open >= 0)
+        spans[open].length = x - spans[open].x;
+      else
+      {
+        open = int32_t(spans.size());
+        spans.push_back({ start, length, false });
+      }
+    }
+    // Widen mixed spans of a pixel or two into the unused pixels around them, so they still
+    // go through the vector kernels; blending or masking a transparent pixel changes nothing
+    const int32_t first = spanRows[y], last = int32_t(spans.size());
+    for (int32_t i = first; i < last; i++)
+    {
+      Span &span = spans[i];
+      if (span.opaque || span.length >= SPAN_MIN_RUN)
+        continue;
+      const int32_t lo = i > first ? spans[i - 1].x + spans[i - 1].length : 0;
+      const int32_t hi = i + 1 < last ? spans[i + 1].x : width;
+      const int32_t end = std::min(hi, span.x + SPAN_MIN_RUN);
+      span.x = std::max(lo, std::min(span.x, end - SPAN_MIN_RUN));
+      span.length = end - span.x;
+    }
+  }
+  spanRows[height] = int32_t(spans.size());
+  spansValid = true;
+}
+
+const Sprite::Span *Sprite::GetSpans(int32_t y, int32_t &count) const
+{
+  UpdateSpans();
+  if (y < 0 || y >= height)
+  {
+    count = 0;
+    return nullptr;
+  }
+  count = spanRows[y + 1] - spanRows[y];
+  return spans.data() + spanRows[y];
+}
+
+Pixel *Sprite::GetData()
+{
+  return pColData;
+}
+
+const Pixel *Sprite::GetData() const
+{
+  return pColData;
+}
+
+void Sprite::BuildMips()
+{
+  mipVersion = GetVersion();
+  size_t levels = 0;
+  const Sprite *above = this;
+  while (above->width > 1 || above->height > 1)
+  {
+    // Levels left from an earlier build keep their buffers when the size class still fits
+    if (levels == mips.size())
+      mips.emplace_back(new Sprite());
+    Sprite &level = *mips[levels++];
+    level.Allocate(std::max(above->width / 2, 1), std::max(above->height / 2, 1));
+    level.modeSample = modeSample;
+    for (int32_t y = 0; y < level.height; y++)
+    {
+      // A single row or column is averaged with itself
+      const Pixel *row0 = above->pColData + std::min(2 * y, above->height - 1) * above->width;
+      const Pixel *row1 = above->pColData + std::min(2 * y + 1, above->height - 1) * above->width;
+      if (above->width == 1)
+      {
+        const Pixel top[2] = { row0[0], row0[0] }, bottom[2] = { row1[0], row1[0] };
+        PixelOps::Downsample2x2(level.pColData + y, top, bottom, 1);
+      }
+      else
+        PixelOps::Downsample2x2(level.pColData + y * level.width, row0, row1, level.width);
+    }
+    above = &level;
+  }
+  mips.resize(levels);
+}
+
+std::future<void> Sprite::BuildMipsAsync()
+{
+  auto result = std::make_shared<std::promise<void>>();
+  std::future<void> built = result->get_future();
+  WorkerPool::Get().Submit([this, result]() { BuildMips(); result->set_value(); });
+  return built;
+}
+
+void Sprite::ClearMips()
+{
+  mips.clear();
+}
+
+int32_t Sprite::GetMipLevels() const
+{
+  return mipVersion == version ? 1 + int32_t(mips.size()) : 1;
+}
+
+const Sprite &Sprite::GetMip(int32_t level) const
+{
+  level = std::min(level, GetMipLevels() - 1);
+  return level <= 0 ? *this : *mips[level - 1];
+}
+
+int32_t Sprite::SelectMip(float footprint) const
+{
+  // Level n has one texel for every 2^n of the sprite, so it matches footprints from 2^n up to 2^(n+1)
+  const int32_t levels = GetMipLevels();
+  if (levels == 1 || !(footprint >= 2.0f))
+    return 0;
+  if (!std::isfinite(footprint))
+    return levels - 1;
+  int exponent;
+  std::frexp(footprint, &exponent);
+  return std::min(exponent - 1, levels - 1);
+}
+
+uint64_t Sprite::GetVersion() const
+{
+  versionSeen = true;
+  return version;
+}
+
+uint64_t Sprite::GetRowVersion(int32_t y) const
+{
+  return y >= 0 && y < height ? rowVersions[y] : 0;
+}
+
+void Sprite::Invalidate(const SDL_Rect *rect)
 {
-  return GetPixel(std::min((int32_t)((x * (float)width)), width - 1), std::min((int32_t)((y * (float)height)), height - 1));
+  int32_t y0 = 0, y1 = height;
+  if (rect)
+  {
+    y0 = std::max(rect->y, 0);
+    y1 = std::min(rect->y + rect->h, height);
+  }
+  if (y0 < y1)
+    Touch(y0, y1);
 }
 
 /////////////////////////////////////////////////////
 
+static bool ClipToScreen(SDL_Rect &rect)
+{
+  static const SDL_Rect screen{ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  SDL_Rect clipped;
+  if (!SDL_IntersectRect(&rect, &screen, &clipped))
+    return false;
+  rect = clipped;
+  return true;
+}
+
+// Moves a partial draw's position from the requested source region to `src`, the part of it inside the
+// image. Flipping mirrors the region, so a flipped axis loses its trimmed far side from the near end.
+static void ShiftToTrimmed(int32_t &x, int32_t &y, const SDL_Rect &requested, const SDL_Rect &src, uint32_t scale, uint8_t flip)
+{
+  const int32_t dx = (flip & Sprite::HORIZ) ? (requested.x + requested.w) - (src.x + src.w) : src.x - requested.x;
+  const int32_t dy = (flip & Sprite::VERT) ? (requested.y + requested.h) - (src.y + src.h) : src.y - requested.y;
+  x += dx * int32_t(scale);
+  y += dy * int32_t(scale);
+}
+
 Window* Window::mainWindow = nullptr;
 uint8_t Window::count = 0;
 Sprite *Window::fontSprite = nullptr;
+uint8_t Window::fontGlyphs[96][8];
 std::vector<Window*> Window::windows;
 
-Window::Window(std::string title, unsigned width, unsigned height)
-  : sdlWindow(nullptr), resX(width), resY(height), midFrame(false)
+Window::Window(std::string title, unsigned width, unsigned height, bool headless)
+  : sdlWindow(nullptr), resX(width), resY(height), midFrame(false), headless(headless)
 {
-  if(count == 0)
+  pFrameBuffer = new Sprite(SCREEN_WIDTH, SCREEN_HEIGHT);
+  std::fill(dirtyMinX, dirtyMinX + SCREEN_HEIGHT, 0);
+  std::fill(dirtyMaxX, dirtyMaxX + SCREEN_HEIGHT, SCREEN_WIDTH - 1);
+  tileBins.resize(TILE_COLUMNS * TILE_ROWS);
+  const char *headlessEnv = std::getenv("SDL_TEMPLATE_HEADLESS");
+  if (headlessEnv && *headlessEnv && std::string(headlessEnv) != "0")
+    this->headless = true;
+  // Headless windows render into a surface in memory, so they need neither video nor audio
+  Uint32 subsystems = this->headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO | SDL_INIT_AUDIO;
+  if (SDL_WasInit(subsystems) != subsystems)
   {
-    if (SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO ) < 0)
+    if (SDL_InitSubSystem(subsystems) < 0)
     {
       Debug::LogError(std::string("SDL could not initialize! SDL_Error: ") + std::string(SDL_GetError()));
       return;
     }
   }
-  sdlWindow = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, resX, resY, SDL_WINDOW_SHOWN);
-  if (!SDL_GL_SetSwapInterval(0))
+  if (this->headless)
   {
-    Debug::LogError(std::string("Could not disable vsync! SDL_Error: ") + std::string(SDL_GetError()));
+    sdlSurface = SDL_CreateRGBSurfaceWithFormat(0, resX, resY, 32, SDL_PIXELFORMAT_RGBA32);
+    if (sdlSurface == nullptr)
+    {
+      Debug::LogError(std::string("Headless surface could not be created! SDL_Error: ") + std::string(SDL_GetError()));
+      return;
+    }
+    sdlRenderer = SDL_CreateSoftwareRenderer(sdlSurface);
   }
-  if(sdlWindow == nullptr)
+  else
   {
-    Debug::LogError(std::string("Window could not be created! SDL_Error: ") + std::string(SDL_GetError()));
-    return;
+    sdlWindow = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, resX, resY, SDL_WINDOW_SHOWN);
+    if (!SDL_GL_SetSwapInterval(0))
+    {
+      Debug::LogError(std::string("Could not disable vsync! SDL_Error: ") + std::string(SDL_GetError()));
+    }
+    if(sdlWindow == nullptr)
+    {
+      Debug::LogError(std::string("Window could not be created! SDL_Error: ") + std::string(SDL_GetError()));
+      return;
+    }
+    int drivers = SDL_GetNumRenderDrivers();
+    Debug::Log("Render driver count: " + std::to_string(drivers));
+    sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
   }
-  int drivers = SDL_GetNumRenderDrivers();
-  Debug::Log("Render driver count: " + std::to_string(drivers));
-  sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
   if(sdlRenderer == nullptr)
   {
     Debug::LogError(std::string("Renderer could not be created! SDL_Error: ") + std::string(SDL_GetError()));
     return;
   }
+  // The frame texture is sized to the output, so it is created by the first present
   /*
   sdlTextureRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
   if (sdlTextureRenderer == nullptr)
@@ -188,7 +625,14 @@ Window::Window(std::string title, unsigned width, unsigned height)
 Window::~Window()
 {
   EndFrame();
+  StopCapture();
+  ClearSpriteTextures();
   ImGuiSDL::Deinitialize();
+  if (sdlFrameTexture)
+  {
+    SDL_DestroyTexture(sdlFrameTexture);
+    sdlFrameTexture = nullptr;
+  }
   if (sdlTextureRenderer)
   {
     SDL_DestroyRenderer(sdlTextureRenderer);
@@ -199,12 +643,23 @@ Window::~Window()
     SDL_DestroyRenderer(sdlRenderer);
     sdlRenderer = nullptr;
   }
+  if (sdlWindow != nullptr || sdlSurface != nullptr)
+    ImGui::DestroyContext();
   if (sdlWindow != nullptr)
   {
-    ImGui::DestroyContext();
     SDL_DestroyWindow(sdlWindow);
     sdlWindow = nullptr;
   }
+  if (sdlSurface != nullptr)
+  {
+    SDL_FreeSurface(sdlSurface);
+    sdlSurface = nullptr;
+  }
+  if (pFrameBuffer)
+  {
+    delete pFrameBuffer;
+    pFrameBuffer = nullptr;
+  }
   if (--count == 0)
   {
     if (fontSprite)
@@ -225,114 +680,1430 @@ Window::~Window()
 
 void Window::SetPixelMode(Pixel::Mode m)
 {
-  nPixelMode = m;
+  // CUSTOM without a functor to call would fail on the first write, so it draws normally instead
+  nPixelMode = m == Pixel::Mode::CUSTOM && !funcPixelMode ? Pixel::Mode::NORMAL : m;
 }
 
-void Window::Clear(Pixel color)
+void Window::SetPixelMode(PixelModeFunction pixelMode)
 {
-  SDL_SetRenderDrawColor(sdlRenderer, color.r, color.g, color.b, 255);
-  DrawRect({ 0, 0, resX / RESOLUTION_SCALE, resY / RESOLUTION_SCALE }, color);
-  SDL_RenderClear(sdlRenderer);
-  DrawRect({0, 0, resX / RESOLUTION_SCALE, resY / RESOLUTION_SCALE}, color);
+  funcPixelMode = pixelMode;
+  nPixelMode = funcPixelMode ? Pixel::Mode::CUSTOM : Pixel::Mode::NORMAL;
+  recordedMode = -1;
 }
 
-void Window::DrawRect(SDL_Rect *rect, unsigned char r, unsigned char g, unsigned char b)
+Pixel::Mode Window::GetPixelMode()
 {
-  SDL_SetRenderDrawColor(sdlRenderer, r, g, b, 255);
-  if (!rect)
-    SDL_RenderDrawRect(sdlRenderer, nullptr);
-  else
+  return nPixelMode;
+}
+
+Window::RasterContext Window::ScreenContext()
+{
+  return RasterContext{ { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }, nPixelMode, &funcPixelMode, true };
+}
+
+void Window::MarkDirty(int32_t x, int32_t y, int32_t count)
+{
+  // Runs longer than the rest of the row (full-width fills) cover whole rows
+  if (x + count > SCREEN_WIDTH)
   {
-    SDL_Rect rect2{rect->x * RESOLUTION_SCALE, rect->y * RESOLUTION_SCALE, rect->w * RESOLUTION_SCALE,  rect->h * RESOLUTION_SCALE};
-    SDL_RenderDrawRect(sdlRenderer, &rect2);
+    int32_t last = std::min(y + (x + count - 1) / SCREEN_WIDTH, SCREEN_HEIGHT - 1);
+    for (int32_t row = y; row <= last; row++)
+    {
+      dirtyMinX[row] = 0;
+      dirtyMaxX[row] = SCREEN_WIDTH - 1;
+    }
+    return;
   }
+  dirtyMinX[y] = std::min(dirtyMinX[y], x);
+  dirtyMaxX[y] = std::max(dirtyMaxX[y], x + count - 1);
 }
 
-void Window::DrawRect(SDL_Rect rect, unsigned char r, unsigned char g, unsigned char b)
+void Window::WriteSpan(const RasterContext &ctx, int32_t x, int32_t y, Pixel color, int32_t count)
 {
-  rect.x *= RESOLUTION_SCALE;
-  rect.y *= RESOLUTION_SCALE;
-  rect.w *= RESOLUTION_SCALE;
-  rect.h *= RESOLUTION_SCALE;
-  SDL_SetRenderDrawColor(sdlRenderer, r, g, b, 255);
-  SDL_RenderDrawRect(sdlRenderer, &rect);
+  if (ctx.markDirty)
+    MarkDirty(x, y, count);
+  Pixel *dst = pFrameBuffer->GetData() + y * SCREEN_WIDTH + x;
+  switch (ctx.mode)
+  {
+  case Pixel::Mode::NORMAL:
+    PixelOps::Fill(dst, color, count);
+    break;
+  case Pixel::Mode::MASK:
+    if (color.a == 255)
+      PixelOps::Fill(dst, color, count);
+    break;
+  case Pixel::Mode::ALPHA:
+    PixelOps::BlendAlpha(dst, color, count);
+    break;
+  case Pixel::Mode::CUSTOM:
+    for (int32_t i = 0; i < count; i++)
+      dst[i] = (*ctx.custom)(x + i, y, color, dst[i]);
+    break;
+  }
 }
 
-void Window::DrawRect(SDL_Rect *rect, Pixel color)
+void Window::WriteRow(const RasterContext &ctx, int32_t x, int32_t y, const Pixel *src, int32_t count)
 {
-  SDL_SetRenderDrawColor(sdlRenderer, color.r, color.g, color.b, 255);
-  if (!rect)
-    SDL_RenderDrawRect(sdlRenderer, nullptr);
-  else
+  if (ctx.markDirty)
+    MarkDirty(x, y, count);
+  Pixel *dst = pFrameBuffer->GetData() + y * SCREEN_WIDTH + x;
+  switch (ctx.mode)
   {
-    SDL_Rect rect2{rect->x * RESOLUTION_SCALE, rect->y * RESOLUTION_SCALE, rect->w * RESOLUTION_SCALE,  rect->h * RESOLUTION_SCALE};
-    SDL_RenderDrawRect(sdlRenderer, &rect2);
+  case Pixel::Mode::NORMAL:
+    PixelOps::Copy(dst, src, count);
+    break;
+  case Pixel::Mode::MASK:
+    PixelOps::CopyMask(dst, src, count);
+    break;
+  case Pixel::Mode::ALPHA:
+    PixelOps::BlendAlpha(dst, src, count);
+    break;
+  case Pixel::Mode::CUSTOM:
+    for (int32_t i = 0; i < count; i++)
+      dst[i] = (*ctx.custom)(x + i, y, src[i], dst[i]);
+    break;
   }
 }
 
-void Window::DrawRect(SDL_Rect rect, Pixel color)
+void Window::WriteMask(const RasterContext &ctx, int32_t x, int32_t y, Pixel color, uint64_t mask, int32_t count)
 {
-  rect.x *= RESOLUTION_SCALE;
-  rect.y *= RESOLUTION_SCALE;
-  rect.w *= RESOLUTION_SCALE;
-  rect.h *= RESOLUTION_SCALE;
-  SDL_SetRenderDrawColor(sdlRenderer, color.r, color.g, color.b, 255);
-  SDL_RenderDrawRect(sdlRenderer, &rect);
+  if (ctx.mode == Pixel::Mode::NORMAL || (ctx.mode == Pixel::Mode::MASK && color.a == 255))
+  {
+    if (ctx.markDirty)
+      MarkDirty(x, y, count);
+    PixelOps::FillMask(pFrameBuffer->GetData() + y * SCREEN_WIDTH + x, color, mask, count);
+    return;
+  }
+  if (ctx.mode == Pixel::Mode::MASK)
+    return;
+  // Blended modes go through the span writer one run of set bits at a time
+  for (int32_t i = 0; i < count;)
+  {
+    if (!((mask >> i) & 1))
+    {
+      i++;
+      continue;
+    }
+    int32_t start = i;
+    while (i < count && ((mask >> i) & 1))
+      i++;
+    WriteSpan(ctx, x + start, y, color, i - start);
+  }
 }
 
-void Window::DrawPixel(int32_t x, int32_t y, unsigned char r, unsigned char g, unsigned char b)
+void Window::RasterFill(const RasterContext &ctx, SDL_Rect rect, Pixel color)
 {
-  DrawRect({x, y, 1, 1}, r, g, b);
+  if (!SDL_IntersectRect(&rect, &ctx.clip, &rect))
+    return;
+  // Full-width rects are one contiguous run, unless the custom mode needs coordinates
+  if (rect.w == SCREEN_WIDTH && ctx.mode != Pixel::Mode::CUSTOM)
+  {
+    WriteSpan(ctx, 0, rect.y, color, rect.w * rect.h);
+    return;
+  }
+  for (int32_t y = rect.y; y < rect.y + rect.h; y++)
+    WriteSpan(ctx, rect.x, y, color, rect.w);
 }
 
-void Window::DrawPixel(int32_t x, int32_t y, Pixel color)
+// Scales, mirrors and clips the `src` region of an image, fetching its rows through
+// rows(srcRow, c0, c1), which returns the pixels of source columns c0 to c1 (inclusive)
+template <class Rows>
+void Window::RasterRows(const RasterContext &ctx, int32_t x, int32_t y, SDL_Rect src, uint32_t scale, uint8_t flip, Rows &&rows)
 {
-  DrawRect({x, y, 1, 1}, color);
+  const int32_t s = int32_t(scale);
+  SDL_Rect dst{ x, y, src.w * s, src.h * s };
+  if (!SDL_IntersectRect(&dst, &ctx.clip, &dst))
+    return;
+
+  const bool flipH = (flip & Sprite::HORIZ) != 0;
+  const bool flipV = (flip & Sprite::VERT) != 0;
+  const int32_t firstCol = (dst.x - x) / s;
+  const int32_t firstPhase = (dst.x - x) % s;
+  const int32_t lastCol = (dst.x + dst.w - 1 - x) / s;
+  // Only the visible source columns are fetched; mirrored, they come from the other end of the row
+  const int32_t c0 = flipH ? src.w - 1 - lastCol : firstCol;
+  const int32_t c1 = flipH ? src.w - 1 - firstCol : lastCol;
+  Pixel row[SCREEN_WIDTH];
+  const Pixel *line = nullptr;
+  int32_t fetchedRow = -1;
+  bool expanded = false;
+  for (int32_t dy = dst.y; dy < dst.y + dst.h; dy++)
+  {
+    int32_t srcRow = (dy - y) / s;
+    if (flipV)
+      srcRow = src.h - 1 - srcRow;
+    if (srcRow != fetchedRow)
+    {
+      line = rows(srcRow, c0, c1);
+      fetchedRow = srcRow;
+      expanded = false;
+    }
+    if (s == 1 && !flipH)
+    {
+      WriteRow(ctx, dst.x, dy, line, dst.w);
+      continue;
+    }
+    // Expand scale and mirroring once per source row, then reuse it for each repeated line
+    if (!expanded)
+    {
+      const int32_t step = flipH ? -1 : 1;
+      const Pixel *p = line + (flipH ? c1 - c0 : 0);
+      int32_t phase = firstPhase;
+      for (int32_t i = 0; i < dst.w; i++)
+      {
+        row[i] = *p;
+        if (++phase == s)
+        {
+          phase = 0;
+          p += step;
+        }
+      }
+      expanded = true;
+    }
+    WriteRow(ctx, dst.x, dy, row, dst.w);
+  }
 }
 
-void Window::SwapBuffers()
+void Window::RasterSprite(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip)
 {
-  //SDL_UpdateWindowSurface(sdlWindow);
-  SDL_RenderPresent(sdlRenderer);
+  if (sprite.GetSpanEncoding() && (ctx.mode == Pixel::Mode::MASK || ctx.mode == Pixel::Mode::ALPHA))
+  {
+    RasterSpans(ctx, x, y, sprite, src, scale, flip);
+    return;
+  }
+  const Pixel *data = sprite.GetData() + src.y * sprite.GetWidth() + src.x;
+  const int32_t width = sprite.GetWidth();
+  RasterRows(ctx, x, y, src, scale, flip, [data, width](int32_t r, int32_t c0, int32_t) { return data + r * width + c0; });
 }
 
-void Window::EndFrame()
+// Like RasterRows, but only writes the source pixels covered by spans, which keeps the
+// result identical to a MASK or ALPHA blit of every pixel
+void Window::RasterSpans(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip)
 {
-  if (midFrame)
+  const int32_t s = int32_t(scale);
+  SDL_Rect dst{ x, y, src.w * s, src.h * s };
+  if (!SDL_IntersectRect(&dst, &ctx.clip, &dst))
+    return;
+
+  const bool flipH = (flip & Sprite::HORIZ) != 0;
+  const bool flipV = (flip & Sprite::VERT) != 0;
+  // Opaque pixels come out the same copied, masked or blended, so their spans are plain copies
+  RasterContext copy = ctx;
+  copy.mode = Pixel::Mode::NORMAL;
+  Pixel row[SCREEN_WIDTH];
+  for (int32_t dy = dst.y; dy < dst.y + dst.h; dy++)
   {
-    ImGui::Render();
-    SetSDLRenderTarget(nullptr);
-    ImGuiSDL::Render(ImGui::GetDrawData());
-    SwapBuffers();
-    ReleaseSDLRenderer();
-    midFrame = false;
+    int32_t srcRow = (dy - y) / s;
+    if (flipV)
+      srcRow = src.h - 1 - srcRow;
+    const Pixel *line = sprite.GetData() + (src.y + srcRow) * sprite.GetWidth() + src.x;
+    int32_t count;
+    const Sprite::Span *span = sprite.GetSpans(src.y + srcRow, count);
+    for (const Sprite::Span *end = span + count; span != end && span->x < src.x + src.w; span++)
+    {
+      // Source columns a to b (exclusive) within src, then the screen columns they land on
+      const int32_t a = std::max(span->x - src.x, 0);
+      const int32_t b = std::min(span->x + span->length - src.x, src.w);
+      if (a >= b)
+        continue;
+      const int32_t left = x + (flipH ? src.w - b : a) * s;
+      const int32_t d0 = std::max(left, dst.x);
+      const int32_t d1 = std::min(left + (b - a) * s, dst.x + dst.w);
+      if (d0 >= d1)
+        continue;
+      const Pixel *p = line + (d0 - x);
+      if (s != 1 || flipH)
+      {
+        const int32_t step = flipH ? -1 : 1;
+        const int32_t col = (d0 - x) / s;
+        const Pixel *q = line + (flipH ? src.w - 1 - col : col);
+        int32_t phase = (d0 - x) % s;
+        for (int32_t i = 0; i < d1 - d0; i++)
+        {
+          row[i] = *q;
+          if (++phase == s)
+          {
+            phase = 0;
+            q += step;
+          }
+        }
+        p = row;
+      }
+      WriteRow(span->opaque ? copy : ctx, d0, dy, p, d1 - d0);
+    }
   }
 }
 
-void Window::Update()
+void Window::RasterScaled(const RasterContext &ctx, int32_t x, int32_t y, const Sprite &sprite, int32_t w, int32_t h, uint8_t flip)
 {
-  EndFrame();
-  ImGui::NewFrame();
-  midFrame = true;
+  SDL_Rect dst{ x, y, w, h };
+  if (!SDL_IntersectRect(&dst, &ctx.clip, &dst))
+    return;
+  const int32_t sw = sprite.GetWidth(), sh = sprite.GetHeight();
+  if (!sprite.GetData() || sw <= 0 || sh <= 0)
+    return;
+  // One screen pixel covers sw / w texels across, which is also what picks the mip level
+  const Sprite &level = sprite.GetMip(sprite.SelectMip(std::max(float(sw) / float(w), float(sh) / float(h))));
+  const int32_t lw = level.GetWidth(), lh = level.GetHeight();
+  // 16.16 steps taken from the sprite's own corner rather than from the clip, so every tile of a
+  // tiled frame samples exactly what a whole screen draw would. Truncating the step keeps the centre
+  // of the last pixel inside the sprite, and a flipped axis walks the same samples back from it.
+  const int64_t du = (int64_t(lw) << 16) / w, dv = (int64_t(lh) << 16) / h;
+  const int64_t u0 = du / 2 + ((flip & Sprite::HORIZ) ? (w - 1) * du : 0);
+  const int64_t v0 = dv / 2 + ((flip & Sprite::VERT) ? (h - 1) * dv : 0);
+  const int64_t stepU = (flip & Sprite::HORIZ) ? -du : du;
+  const int64_t stepV = (flip & Sprite::VERT) ? -dv : dv;
+  const int64_t u = u0 + (dst.x - x) * stepU;
+  const PixelOps::Address address = ToAddress(sprite.GetSampleMode());
+  Pixel row[SCREEN_WIDTH];
+  for (int32_t dy = dst.y; dy < dst.y + dst.h; dy++)
+  {
+    PixelOps::SampleNearest(row, level.GetData(), lw, lh, u, v0 + (dy - y) * stepV, stepU, 0, dst.w, address);
+    WriteRow(ctx, dst.x, dy, row, dst.w);
+  }
 }
 
-bool Window::HandleEvent(SDL_Event *event)
+static int64_t FloorDiv(int64_t n, int64_t d)
 {
-  return false;
+  return n / d - ((n % d != 0) && ((n < 0) != (d < 0)));
 }
 
-void Window::ConstructFontSheet()
+static int64_t CeilDiv(int64_t n, int64_t d)
 {
-  std::string data;
-  data += "?Q`0001oOch0o01o@F40o0<AGD4090LAGD<090@A7ch0?00O7Q`0600>00000000";
-  data += "O000000nOT0063Qo4d8>?7a14Gno94AA4gno94AaOT0>o3`oO400o7QN00000400";
-  data += "Of80001oOg<7O7moBGT7O7lABET024@aBEd714AiOdl717a_=TH013Q>00000000";
-  data += "720D000V?V5oB3Q_HdUoE7a9@DdDE4A9@DmoE4A;Hg]oM4Aj8S4D84@`00000000";
-  data += "OaPT1000Oa`^13P1@AI[?g`1@A=[OdAoHgljA4Ao?WlBA7l1710007l100000000";
-  data += "ObM6000oOfMV?3QoBDD`O7a0BDDH@5A0BDD<@5A0BGeVO5ao@CQR?5Po00000000";
-  data += "Oc``000?Ogij70PO2D]??0Ph2DUM@7i`2DTg@7lh2GUj?0TO0C1870T?00000000";
-  data += "70<4001o?P<7?1QoHg43O;`h@GT0@:@LB@d0>:@hN@L0@?aoN@<0O7ao0000?000";
-  data += "OcH0001SOglLA7mg24TnK7ln24US>0PL24U140PnOgl0>7QgOcH0K71S0000A000";
+  return -FloorDiv(-n, d);
+}
+
+// Narrows [first, last] to the steps i where lo <= s + i * d < hi; false when none are left
+static bool NarrowSpan(int64_t s, int64_t d, int64_t lo, int64_t hi, int64_t &first, int64_t &last)
+{
+  if (d == 0)
+    return s >= lo && s < hi && first <= last;
+  if (d > 0)
+  {
+    first = std::max(first, CeilDiv(lo - s, d));
+    last = std::min(last, FloorDiv(hi - 1 - s, d));
+  }
+  else
+  {
+    first = std::max(first, CeilDiv(s - hi + 1, -d));
+    last = std::min(last, FloorDiv(s - lo, -d));
+  }
+  return first <= last;
+}
+
+// Texel coordinates to 16.16 fixed point, kept far enough from the int64_t limits that a row of steps can't overflow
+static int64_t ToFixed(double t)
+{
+  const double limit = 1099511627776.0;
+  return int64_t(std::floor(std::min(std::max(t * 65536.0, -limit), limit) + 0.5));
+}
+
+// The pixels covered by the transformed `w` x `h` rectangle, cut down to `clip`
+static bool TransformedBounds(const Affine2D &transform, int32_t w, int32_t h, const SDL_Rect &clip, SDL_Rect &out)
+{
+  float minX = std::numeric_limits<float>::max(), maxX = -minX, minY = minX, maxY = -minX;
+  const float corners[4][2] = { { 0.0f, 0.0f }, { float(w), 0.0f }, { 0.0f, float(h) }, { float(w), float(h) } };
+  for (const auto &corner : corners)
+  {
+    float cx, cy;
+    transform.Apply(corner[0], corner[1], cx, cy);
+    minX = std::min(minX, cx);
+    maxX = std::max(maxX, cx);
+    minY = std::min(minY, cy);
+    maxY = std::max(maxY, cy);
+  }
+  // NaN fails every comparison, so a broken transform ends up here too
+  if (!(minX <= maxX) || !(minY <= maxY))
+    return false;
+  out.x = int32_t(std::floor(std::max(minX, float(clip.x))));
+  out.y = int32_t(std::floor(std::max(minY, float(clip.y))));
+  out.w = int32_t(std::ceil(std::min(maxX, float(clip.x + clip.w)))) - out.x;
+  out.h = int32_t(std::ceil(std::min(maxY, float(clip.y + clip.h)))) - out.y;
+  return out.w > 0 && out.h > 0;
+}
+
+void Window::RasterTransformed(const RasterContext &ctx, const Sprite &sprite, const Affine2D &transform, bool filtered)
+{
+  const int32_t sw = sprite.GetWidth(), sh = sprite.GetHeight();
+  Affine2D inverse;
+  if (!sprite.GetData() || sw <= 0 || sh <= 0 || !transform.Invert(inverse))
+    return;
+
+  // Only pixels inside the transformed sprite's bounding box can have their centre on it
+  SDL_Rect box;
+  if (!TransformedBounds(transform, sw, sh, ctx.clip, box))
+    return;
+
+  // One screen pixel moves (a, c) texels to the right and (b, d) down; the longer of the two picks the mip level
+  const float footprint = std::max(std::hypot(inverse.a, inverse.c), std::hypot(inverse.b, inverse.d));
+  const Sprite &level = sprite.GetMip(sprite.SelectMip(footprint));
+  const int32_t lw = level.GetWidth(), lh = level.GetHeight();
+  const double su = double(lw) / sw, sv = double(lh) / sh;
+  // Texel positions are stepped from the centre of screen pixel (0, 0) rather than from the clip,
+  // so every tile of a tiled frame lands on exactly the samples a whole screen draw would
+  const int64_t du = ToFixed(inverse.a * su), dv = ToFixed(inverse.c * sv);
+  const int64_t rowDu = ToFixed(inverse.b * su), rowDv = ToFixed(inverse.d * sv);
+  const int64_t u0 = ToFixed((0.5 * inverse.a + 0.5 * inverse.b + inverse.tx) * su);
+  const int64_t v0 = ToFixed((0.5 * inverse.c + 0.5 * inverse.d + inverse.ty) * sv);
+  const int64_t uMax = int64_t(lw) << 16, vMax = int64_t(lh) << 16;
+  const PixelOps::Address address = ToAddress(sprite.GetSampleMode());
+
+  Pixel row[SCREEN_WIDTH];
+  for (int32_t y = box.y; y < box.y + box.h; y++)
+  {
+    const int64_t u = u0 + y * rowDu, v = v0 + y * rowDv;
+    // Only the columns whose sample lands inside the sprite, found with the same steps the samplers take
+    int64_t first = box.x, last = box.x + box.w - 1;
+    if (!NarrowSpan(u, du, 0, uMax, first, last) || !NarrowSpan(v, dv, 0, vMax, first, last))
+      continue;
+    const int32_t count = int32_t(last - first + 1);
+    if (filtered)
+      PixelOps::SampleBilinear(row, level.GetData(), lw, lh, u + first * du - 0x8000, v + first * dv - 0x8000, du, dv, count, address);
+    else
+      PixelOps::SampleNearest(row, level.GetData(), lw, lh, u + first * du, v + first * dv, du, dv, count, address);
+    WriteRow(ctx, int32_t(first), y, row, count);
+  }
+}
+
+void Window::RasterIndexed(const RasterContext &ctx, int32_t x, int32_t y, const IndexedSprite &sprite, SDL_Rect src, uint32_t scale, uint8_t flip, const Pixel *palette)
+{
+  // At most one source column per screen column is visible, so a screen row always has room
+  Pixel colors[SCREEN_WIDTH];
+  RasterRows(ctx, x, y, src, scale, flip, [&](int32_t r, int32_t c0, int32_t c1)
+  {
+    sprite.ExpandRow(src.x + c0, src.y + r, c1 - c0 + 1, colors, palette);
+    return static_cast<const Pixel *>(colors);
+  });
+}
+
+void Window::RasterLayers(const RasterContext &ctx, const Background *background, const ObjectLayer *objects, bool callbacks)
+{
+  // Without a background, rows start out transparent and only what the objects cover is written
+  RasterContext over = ctx;
+  if (!background && over.mode == Pixel::Mode::NORMAL)
+    over.mode = Pixel::Mode::MASK;
+  // Callbacks see every line, including the ones outside the clip, so their effects don't depend on it
+  callbacks = callbacks && !scanlineHooks.empty();
+  const int32_t first = callbacks ? 0 : ctx.clip.y;
+  const int32_t last = callbacks ? SCREEN_HEIGHT : ctx.clip.y + ctx.clip.h;
+  Pixel row[SCREEN_WIDTH];
+  for (int32_t y = first; y < last; y++)
+  {
+    for (size_t i = 0; callbacks && i < scanlineHooks.size(); i++)
+      if (scanlineHooks[i].line < 0 || scanlineHooks[i].line == y)
+        scanlineHooks[i].callback(y);
+    if (y < ctx.clip.y || y >= ctx.clip.y + ctx.clip.h)
+      continue;
+    if (background)
+      background->RenderRow(y, ctx.clip.x, ctx.clip.w, row);
+    else
+      PixelOps::Fill(row, Color::BLANK, ctx.clip.w);
+    const bool covered = objects && objects->RenderRow(y, ctx.clip.x, ctx.clip.w, row);
+    if (background || covered)
+      WriteRow(over, ctx.clip.x, y, row, ctx.clip.w);
+  }
+}
+
+void Window::RasterString(const RasterContext &ctx, int32_t x, int32_t y, const char *text, size_t length, Pixel color, uint32_t scale)
+{
+  const int32_t s = int32_t(scale);
+  const int32_t cell = 8 * s;
+  const int32_t clipX2 = ctx.clip.x + ctx.clip.w, clipY2 = ctx.clip.y + ctx.clip.h;
+  int32_t sx = 0, sy = 0;
+  for (size_t n = 0; n < length; n++)
+  {
+    const unsigned char c = static_cast<unsigned char>(text[n]);
+    if (c == '\n')
+    {
+      sx = 0;
+      sy += cell;
+      continue;
+    }
+    const int32_t gx = x + sx, gy = y + sy;
+    sx += cell;
+    if (c < 32 || c > 127 || gx >= clipX2 || gx + cell <= ctx.clip.x || gy >= clipY2 || gy + cell <= ctx.clip.y)
+      continue;
+    const uint8_t *glyph = fontGlyphs[c - 32];
+    const int32_t x0 = std::max(gx, ctx.clip.x), x1 = std::min(gx + cell, clipX2);
+    const int32_t y0 = std::max(gy, ctx.clip.y), y1 = std::min(gy + cell, clipY2);
+    for (int32_t py = y0; py < y1; py++)
+    {
+      uint8_t bits = glyph[(py - gy) / s];
+      if (!bits)
+        continue;
+      if (s > 8)
+      {
+        // Too wide for a 64 bit row mask, draw each set bit as a span instead
+        for (int32_t i = 0; i < 8; i++)
+          if ((bits >> i) & 1)
+            RasterFill(ctx, { gx + i * s, py, s, 1 }, color);
+        continue;
+      }
+      uint64_t mask = 0;
+      for (int32_t i = 0; i < 8; i++)
+        if ((bits >> i) & 1)
+          mask |= ((uint64_t(1) << s) - 1) << (i * s);
+      mask >>= (x0 - gx);
+      WriteMask(ctx, x0, py, color, mask, x1 - x0);
+    }
+  }
+}
+
+void Window::Record(DrawCommand &cmd)
+{
+  cmd.mode = nPixelMode;
+  cmd.custom = -1;
+  if (nPixelMode == Pixel::Mode::CUSTOM)
+  {
+    // Keep a copy of the functor so later SetPixelMode calls don't affect queued commands
+    if (recordedMode < 0)
+    {
+      recordedModes.push_back(funcPixelMode);
+      recordedMode = int32_t(recordedModes.size()) - 1;
+    }
+    cmd.custom = recordedMode;
+  }
+  recordedDraws.push_back(cmd);
+  const TileEntry entry{ uint32_t(recordedDraws.size() - 1), 0 };
+  const SDL_Rect &b = cmd.bounds;
+  for (int32_t ty = b.y / TILE_SIZE; ty <= (b.y + b.h - 1) / TILE_SIZE; ty++)
+    for (int32_t tx = b.x / TILE_SIZE; tx <= (b.x + b.w - 1) / TILE_SIZE; tx++)
+      tileBins[ty * TILE_COLUMNS + tx].push_back(entry);
+  recordedCommands++;
+}
+
+void Window::SubmitFill(SDL_Rect rect, Pixel color)
+{
+  if (!ClipToScreen(rect))
+    return;
+  if (!tiled)
+  {
+    RasterFill(ScreenContext(), rect, color);
+    return;
+  }
+  // Custom modes need their functor kept, which only a DrawCommand does
+  if (nPixelMode == Pixel::Mode::CUSTOM)
+  {
+    DrawCommand cmd{};
+    cmd.kind = DrawCommand::FILL;
+    cmd.bounds = rect;
+    cmd.color = color;
+    Record(cmd);
+    return;
+  }
+  // Each tile gets the part of the fill inside it, packed into a single entry
+  static_assert(TILE_SIZE == 32, "fill entries pack tile coordinates into 5 bits");
+  const uint32_t mode = FILL_ENTRY | uint32_t(nPixelMode) << 20;
+  const int32_t right = rect.x + rect.w, bottom = rect.y + rect.h;
+  for (int32_t ty = rect.y / TILE_SIZE; ty <= (bottom - 1) / TILE_SIZE; ty++)
+  {
+    const int32_t top = ty * TILE_SIZE;
+    const int32_t y0 = std::max(rect.y, top) - top, y1 = std::min(bottom, top + TILE_SIZE) - top;
+    for (int32_t tx = rect.x / TILE_SIZE; tx <= (right - 1) / TILE_SIZE; tx++)
+    {
+      const int32_t left = tx * TILE_SIZE;
+      const int32_t x0 = std::max(rect.x, left) - left, x1 = std::min(right, left + TILE_SIZE) - left;
+      const TileEntry entry{ mode | uint32_t(y1 - y0 - 1) << 15 | uint32_t(x1 - x0 - 1) << 10 | uint32_t(y0) << 5 | uint32_t(x0), color.n };
+      tileBins[ty * TILE_COLUMNS + tx].push_back(entry);
+    }
+  }
+  recordedCommands++;
+}
+
+void Window::RasterTile(uint32_t tile)
+{
+  SDL_Rect bounds{ int32_t(tile % TILE_COLUMNS) * TILE_SIZE, int32_t(tile / TILE_COLUMNS) * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+  RasterContext ctx{ bounds, Pixel::Mode::NORMAL, nullptr, false };
+  ClipToScreen(ctx.clip);
+  for (const TileEntry &entry : tileBins[tile])
+  {
+    if (entry.command & FILL_ENTRY)
+    {
+      // Clipped to the screen and to this tile when it was recorded
+      ctx.mode = Pixel::Mode(entry.command >> 20 & 3);
+      ctx.custom = nullptr;
+      const int32_t x = bounds.x + int32_t(entry.command & 31), y = bounds.y + int32_t(entry.command >> 5 & 31);
+      const int32_t w = int32_t(entry.command >> 10 & 31) + 1, h = int32_t(entry.command >> 15 & 31) + 1;
+      const Pixel color(entry.color);
+      for (int32_t row = y; row < y + h; row++)
+        WriteSpan(ctx, x, row, color, w);
+      continue;
+    }
+    const DrawCommand &cmd = recordedDraws[entry.command];
+    ctx.mode = cmd.mode;
+    ctx.custom = cmd.custom >= 0 ? &recordedModes[cmd.custom] : nullptr;
+    switch (cmd.kind)
+    {
+    case DrawCommand::FILL:
+      RasterFill(ctx, cmd.bounds, cmd.color);
+      break;
+    case DrawCommand::SPRITE:
+      RasterSprite(ctx, cmd.x, cmd.y, *cmd.sprite, cmd.source, cmd.scale, cmd.flip);
+      break;
+    case DrawCommand::SCALED:
+      RasterScaled(ctx, cmd.x, cmd.y, *cmd.sprite, cmd.source.w, cmd.source.h, cmd.flip);
+      break;
+    case DrawCommand::TRANSFORMED:
+      RasterTransformed(ctx, *cmd.sprite, recordedTransforms[cmd.source.x], cmd.scale != 0);
+      break;
+    case DrawCommand::INDEXED:
+      RasterIndexed(ctx, cmd.x, cmd.y, *cmd.indexed, cmd.source, cmd.scale, cmd.flip, cmd.palette);
+      break;
+    case DrawCommand::LAYERS:
+      RasterLayers(ctx, cmd.background, cmd.objects, false);
+      break;
+    case DrawCommand::STRING:
+      RasterString(ctx, cmd.x, cmd.y, recordedText.data() + cmd.source.x, size_t(cmd.source.w), cmd.color, cmd.scale);
+      break;
+    }
+  }
+}
+
+void Window::FlushTiles()
+{
+  if (recordedCommands == 0)
+    return;
+  activeTiles.clear();
+  for (uint32_t t = 0; t < tileBins.size(); t++)
+    if (!tileBins[t].empty())
+      activeTiles.push_back(t);
+  // Object layers sort themselves into scanlines lazily; do it here, before the workers share them
+  for (const ObjectLayer *objects : recordedObjects)
+    objects->Evaluate();
+  // Tiles never share pixels, so workers only ever touch their own part of the framebuffer
+  WorkerPool::Get().ParallelFor(uint32_t(activeTiles.size()), [this](uint32_t i) { RasterTile(activeTiles[i]); });
+  for (uint32_t t : activeTiles)
+  {
+    tileBins[t].clear();
+    SDL_Rect tile{ int32_t(t % TILE_COLUMNS) * TILE_SIZE, int32_t(t / TILE_COLUMNS) * TILE_SIZE, TILE_SIZE, TILE_SIZE };
+    Invalidate(&tile);
+  }
+  recordedCommands = 0;
+  recordedDraws.clear();
+  recordedModes.clear();
+  recordedMode = -1;
+  recordedText.clear();
+  recordedTransforms.clear();
+  recordedObjects.clear();
+}
+
+void Window::SetTiledRendering(bool enabled)
+{
+  if (!enabled)
+    FlushTiles();
+  tiled = enabled;
+}
+
+bool Window::GetTiledRendering()
+{
+  return tiled;
+}
+
+void Window::Clear(Pixel color)
+{
+  SDL_SetRenderDrawColor(sdlRenderer, color.r, color.g, color.b, 255);
+  SDL_RenderClear(sdlRenderer);
+  if (tiled)
+  {
+    // Clear ignores the pixel mode, so queue it as a plain fill
+    Pixel::Mode mode = nPixelMode;
+    nPixelMode = Pixel::Mode::NORMAL;
+    SubmitFill({ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }, color);
+    nPixelMode = mode;
+    return;
+  }
+  PixelOps::Fill(pFrameBuffer->GetData(), color, SCREEN_WIDTH * SCREEN_HEIGHT);
+  MarkDirty(0, 0, SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+void Window::DrawRect(SDL_Rect *rect, unsigned char r, unsigned char g, unsigned char b)
+{
+  DrawRect(rect, Pixel(r, g, b));
+}
+
+void Window::DrawRect(SDL_Rect rect, unsigned char r, unsigned char g, unsigned char b)
+{
+  DrawRect(rect, Pixel(r, g, b));
+}
+
+void Window::DrawRect(SDL_Rect *rect, Pixel color)
+{
+  if (!rect)
+    DrawRect({ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }, color);
+  else
+    DrawRect(*rect, color);
+}
+
+void Window::DrawRect(SDL_Rect rect, Pixel color)
+{
+  if (rect.w <= 0 || rect.h <= 0)
+    return;
+  if (batching && nPixelMode != Pixel::Mode::CUSTOM)
+  {
+    QueueRect(DrawBatch::OUTLINE, rect, color);
+    return;
+  }
+  int32_t x2 = rect.x + rect.w - 1;
+  int32_t y2 = rect.y + rect.h - 1;
+  DrawHLine(rect.x, x2, rect.y, color);
+  if (y2 != rect.y)
+    DrawHLine(rect.x, x2, y2, color);
+  if (rect.h > 2)
+  {
+    DrawVLine(rect.x, rect.y + 1, y2 - 1, color);
+    if (x2 != rect.x)
+      DrawVLine(x2, rect.y + 1, y2 - 1, color);
+  }
+}
+
+void Window::FillRect(SDL_Rect *rect, Pixel color)
+{
+  if (!rect)
+    FillRect({ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT }, color);
+  else
+    FillRect(*rect, color);
+}
+
+void Window::FillRect(SDL_Rect rect, Pixel color)
+{
+  if (batching && nPixelMode != Pixel::Mode::CUSTOM)
+  {
+    if (ClipToScreen(rect))
+      QueueRect(DrawBatch::FILL, rect, color);
+    return;
+  }
+  SubmitFill(rect, color);
+}
+
+void Window::DrawHLine(int32_t x1, int32_t x2, int32_t y, Pixel color)
+{
+  if (x2 < x1)
+    std::swap(x1, x2);
+  SubmitFill({ x1, y, x2 - x1 + 1, 1 }, color);
+}
+
+void Window::DrawVLine(int32_t x, int32_t y1, int32_t y2, Pixel color)
+{
+  if (y2 < y1)
+    std::swap(y1, y2);
+  SubmitFill({ x, y1, 1, y2 - y1 + 1 }, color);
+}
+
+void Window::FillSpan(int32_t x, int32_t y, int32_t length, Pixel color)
+{
+  SubmitFill({ x, y, length, 1 }, color);
+}
+
+void Window::DrawPixel(int32_t x, int32_t y, unsigned char r, unsigned char g, unsigned char b)
+{
+  DrawPixel(x, y, Pixel(r, g, b));
+}
+
+void Window::DrawPixel(int32_t x, int32_t y, Pixel color)
+{
+  if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT)
+    return;
+  if (tiled)
+    SubmitFill({ x, y, 1, 1 }, color);
+  else
+    WriteSpan(ScreenContext(), x, y, color, 1);
+}
+
+void Window::DrawString(int32_t x, int32_t y, const std::string &text, Pixel color, uint32_t scale)
+{
+  if (scale == 0)
+    return;
+  if (!fontSprite)
+    ConstructFontSheet();
+  if (!tiled)
+  {
+    RasterString(ScreenContext(), x, y, text.data(), text.size(), color, scale);
+    return;
+  }
+  int32_t columns = 0, lines = 1, column = 0;
+  for (char c : text)
+  {
+    if (c == '\n')
+    {
+      lines++;
+      column = 0;
+    }
+    else
+      columns = std::max(columns, ++column);
+  }
+  const int32_t cell = 8 * int32_t(scale);
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::STRING;
+  cmd.bounds = { x, y, columns * cell, lines * cell };
+  if (!ClipToScreen(cmd.bounds))
+    return;
+  cmd.color = color;
+  cmd.x = x;
+  cmd.y = y;
+  cmd.source = { int32_t(recordedText.size()), 0, int32_t(text.size()), 0 };
+  cmd.scale = scale;
+  recordedText += text;
+  Record(cmd);
+}
+
+void Window::DrawSprite(int32_t x, int32_t y, const Sprite &sprite, uint32_t scale, uint8_t flip)
+{
+  DrawPartialSprite(x, y, sprite, 0, 0, sprite.GetWidth(), sprite.GetHeight(), scale, flip);
+}
+
+void Window::DrawPartialSprite(int32_t x, int32_t y, const Sprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip)
+{
+  if (scale == 0 || !sprite.GetData())
+    return;
+  // Trim the source region to the sprite so the row loops never need bounds checks
+  SDL_Rect src{ ox, oy, w, h };
+  SDL_Rect bounds{ 0, 0, sprite.GetWidth(), sprite.GetHeight() };
+  if (!SDL_IntersectRect(&src, &bounds, &src))
+    return;
+  ShiftToTrimmed(x, y, { ox, oy, w, h }, src, scale, flip);
+  // Tiles read the spans from worker threads, so they have to be up to date before recording
+  if (sprite.GetSpanEncoding() && (nPixelMode == Pixel::Mode::MASK || nPixelMode == Pixel::Mode::ALPHA))
+    sprite.UpdateSpans();
+  if (!tiled)
+  {
+    RasterSprite(ScreenContext(), x, y, sprite, src, scale, flip);
+    return;
+  }
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::SPRITE;
+  cmd.bounds = { x, y, src.w * int32_t(scale), src.h * int32_t(scale) };
+  if (!ClipToScreen(cmd.bounds))
+    return;
+  cmd.x = x;
+  cmd.y = y;
+  cmd.sprite = &sprite;
+  cmd.source = src;
+  cmd.scale = scale;
+  cmd.flip = flip;
+  Record(cmd);
+}
+
+void Window::DrawScaledSprite(int32_t x, int32_t y, const Sprite &sprite, float scale, uint8_t flip)
+{
+  if (!(scale > 0.0f) || !sprite.GetData())
+    return;
+  const int32_t w = std::max(int32_t(std::min(float(sprite.GetWidth()) * scale, 65536.0f) + 0.5f), 1);
+  const int32_t h = std::max(int32_t(std::min(float(sprite.GetHeight()) * scale, 65536.0f) + 0.5f), 1);
+  if (!tiled)
+  {
+    RasterScaled(ScreenContext(), x, y, sprite, w, h, flip);
+    return;
+  }
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::SCALED;
+  cmd.bounds = { x, y, w, h };
+  if (!ClipToScreen(cmd.bounds))
+    return;
+  cmd.x = x;
+  cmd.y = y;
+  cmd.sprite = &sprite;
+  cmd.source = { 0, 0, w, h };
+  cmd.flip = flip;
+  Record(cmd);
+}
+
+void Window::DrawSpriteTransformed(const Sprite &sprite, const Affine2D &transform, bool filtered)
+{
+  if (!tiled)
+  {
+    RasterTransformed(ScreenContext(), sprite, transform, filtered);
+    return;
+  }
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::TRANSFORMED;
+  const SDL_Rect screen{ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  if (!sprite.GetData() || !TransformedBounds(transform, sprite.GetWidth(), sprite.GetHeight(), screen, cmd.bounds))
+    return;
+  cmd.sprite = &sprite;
+  cmd.source = { int32_t(recordedTransforms.size()), 0, 0, 0 };
+  cmd.scale = filtered ? 1 : 0;
+  recordedTransforms.push_back(transform);
+  Record(cmd);
+}
+
+void Window::DrawSprite(int32_t x, int32_t y, const IndexedSprite &sprite, uint32_t scale, uint8_t flip, const Pixel *palette)
+{
+  DrawPartialSprite(x, y, sprite, 0, 0, sprite.GetWidth(), sprite.GetHeight(), scale, flip, palette);
+}
+
+void Window::DrawPartialSprite(int32_t x, int32_t y, const IndexedSprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip, const Pixel *palette)
+{
+  if (scale == 0 || sprite.GetWidth() == 0)
+    return;
+  SDL_Rect src{ ox, oy, w, h };
+  SDL_Rect bounds{ 0, 0, sprite.GetWidth(), sprite.GetHeight() };
+  if (!SDL_IntersectRect(&src, &bounds, &src))
+    return;
+  ShiftToTrimmed(x, y, { ox, oy, w, h }, src, scale, flip);
+  if (!tiled)
+  {
+    RasterIndexed(ScreenContext(), x, y, sprite, src, scale, flip, palette);
+    return;
+  }
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::INDEXED;
+  cmd.bounds = { x, y, src.w * int32_t(scale), src.h * int32_t(scale) };
+  if (!ClipToScreen(cmd.bounds))
+    return;
+  cmd.x = x;
+  cmd.y = y;
+  cmd.indexed = &sprite;
+  cmd.palette = palette;
+  cmd.source = src;
+  cmd.scale = scale;
+  cmd.flip = flip;
+  Record(cmd);
+}
+
+void Window::DrawBackground(const Background &background)
+{
+  DrawLayers(&background, nullptr);
+}
+
+void Window::DrawObjects(const ObjectLayer &objects)
+{
+  DrawLayers(nullptr, &objects);
+}
+
+void Window::DrawLayers(const Background *background, const ObjectLayer *objects)
+{
+  if (!background && !objects)
+    return;
+  if (!tiled || !scanlineHooks.empty())
+  {
+    // Callbacks change layer state between lines, so the lines have to be drawn in order, now;
+    // anything recorded before goes first
+    if (tiled)
+      FlushTiles();
+    if (objects)
+      objects->Evaluate();
+    RasterLayers(ScreenContext(), background, objects, true);
+    return;
+  }
+  DrawCommand cmd{};
+  cmd.kind = DrawCommand::LAYERS;
+  cmd.bounds = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  cmd.background = background;
+  cmd.objects = objects;
+  if (objects)
+    recordedObjects.push_back(objects);
+  Record(cmd);
+}
+
+int32_t Window::AddScanlineCallback(ScanlineCallback callback, int32_t line)
+{
+  if (!callback || line >= SCREEN_HEIGHT)
+    return -1;
+  scanlineHooks.push_back({ nextScanlineHook, std::max<int32_t>(line, -1), std::move(callback) });
+  return nextScanlineHook++;
+}
+
+void Window::RemoveScanlineCallback(int32_t id)
+{
+  scanlineHooks.erase(std::remove_if(scanlineHooks.begin(), scanlineHooks.end(), [id](const ScanlineHook &hook) { return hook.id == id; }),
+                      scanlineHooks.end());
+}
+
+void Window::ClearScanlineCallbacks()
+{
+  scanlineHooks.clear();
+}
+
+void Window::UpdateOutput()
+{
+  SDL_Rect area = outputArea;
+  if (outputFollowsWindow)
+  {
+    area = { 0, 0, 0, 0 };
+    if (SDL_GetRendererOutputSize(sdlRenderer, &area.w, &area.h))
+      return;
+  }
+  area.w = std::max(area.w, 1);
+  area.h = std::max(area.h, 1);
+  int32_t w, h;
+  if (outputScale == SCALE_INTEGER)
+  {
+    const int32_t scale = std::max(std::min(area.w / SCREEN_WIDTH, area.h / SCREEN_HEIGHT), 1);
+    w = SCREEN_WIDTH * scale;
+    h = SCREEN_HEIGHT * scale;
+  }
+  else
+  {
+    const double frameW = SCREEN_WIDTH, frameH = SCREEN_HEIGHT * (outputScale == SCALE_STRETCH_4_3 ? SCREEN_STRETCH_4_3 : 1.0f);
+    const double scale = std::min(area.w / frameW, area.h / frameH);
+    w = std::max(int32_t(frameW * scale + 0.5), 1);
+    h = std::max(int32_t(frameH * scale + 0.5), 1);
+  }
+  const SDL_Rect rect{ area.x + (area.w - w) / 2, area.y + (area.h - h) / 2, w, h };
+  if (rect.x == outputRect.x && rect.y == outputRect.y && rect.w == outputRect.w && rect.h == outputRect.h)
+    return;
+
+  // Nearest sampling: output column x shows source column x * SCREEN_WIDTH / w, so the first
+  // output row (or column) showing source row s is the smallest one reaching s, ceil(s * h / SCREEN_HEIGHT)
+  outputRect = rect;
+  outputColumns.resize(size_t(w));
+  for (int32_t x = 0; x < w; x++)
+    outputColumns[x] = int32_t(int64_t(x) * SCREEN_WIDTH / w);
+  for (int32_t y = 0; y <= SCREEN_HEIGHT; y++)
+    outputRows[y] = int32_t((int64_t(y) * h + SCREEN_HEIGHT - 1) / SCREEN_HEIGHT);
+  outputPixels.assign(size_t(w) * h, Pixel());
+  if (sdlFrameTexture)
+    SDL_DestroyTexture(sdlFrameTexture);
+  sdlFrameTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, w, h);
+  if (sdlFrameTexture == nullptr)
+    Debug::LogError(std::string("Frame texture could not be created! SDL_Error: ") + std::string(SDL_GetError()));
+  else
+    SDL_SetTextureBlendMode(sdlFrameTexture, SDL_BLENDMODE_NONE);
+  Invalidate();
+}
+
+void Window::PresentFrameBuffer()
+{
+  if (!sdlRenderer)
+    return;
+  UpdateOutput();
+  if (!sdlFrameTexture)
+    return;
+  // The texture keeps last frame's contents, so only rows touched since then are scaled and uploaded.
+  // Consecutive dirty rows are merged into one rect spanning the union of their ranges.
+  const int32_t w = outputRect.w;
+  const int pitch = w * sizeof(Pixel);
+  uploadedPixels = 0;
+  if (fullRedraw)
+    Invalidate();
+  for (int32_t y = 0; y < SCREEN_HEIGHT;)
+  {
+    if (dirtyMinX[y] > dirtyMaxX[y])
+    {
+      y++;
+      continue;
+    }
+    int32_t minX = dirtyMinX[y];
+    int32_t maxX = dirtyMaxX[y];
+    int32_t end = y;
+    for (; end < SCREEN_HEIGHT && dirtyMinX[end] <= dirtyMaxX[end]; end++)
+    {
+      minX = std::min(minX, dirtyMinX[end]);
+      maxX = std::max(maxX, dirtyMaxX[end]);
+      dirtyMinX[end] = SCREEN_WIDTH;
+      dirtyMaxX[end] = -1;
+    }
+    // The output columns showing source columns minX to maxX
+    const int32_t x0 = int32_t((int64_t(minX) * w + SCREEN_WIDTH - 1) / SCREEN_WIDTH);
+    const int32_t x1 = int32_t((int64_t(maxX + 1) * w + SCREEN_WIDTH - 1) / SCREEN_WIDTH);
+    SDL_Rect rect{ x0, outputRows[y], x1 - x0, outputRows[end] - outputRows[y] };
+    if (rect.w > 0 && rect.h > 0)
+    {
+      // One pass: each source row is scaled once through the column table, then copied down to the rest of its output rows
+      for (int32_t row = y; row < end; row++)
+      {
+        if (outputRows[row] == outputRows[row + 1])
+          continue;
+        const Pixel *src = pFrameBuffer->GetData() + row * SCREEN_WIDTH;
+        Pixel *dst = outputPixels.data() + size_t(outputRows[row]) * w;
+        for (int32_t x = x0; x < x1; x++)
+          dst[x] = src[outputColumns[x]];
+        for (int32_t copy = outputRows[row] + 1; copy < outputRows[row + 1]; copy++)
+          std::memcpy(outputPixels.data() + size_t(copy) * w + x0, dst + x0, size_t(rect.w) * sizeof(Pixel));
+      }
+      SDL_UpdateTexture(sdlFrameTexture, &rect, outputPixels.data() + size_t(rect.y) * w + rect.x, pitch);
+      uploadedPixels += uint32_t(rect.w * rect.h);
+    }
+    y = end;
+  }
+  SDL_RenderCopy(sdlRenderer, sdlFrameTexture, nullptr, &outputRect);
+}
+
+void Window::SetScreenTransform(bool enabled)
+{
+  if (!enabled)
+  {
+    SDL_RenderSetClipRect(sdlRenderer, nullptr);
+    SDL_RenderSetScale(sdlRenderer, 1.0f, 1.0f);
+    SDL_RenderSetViewport(sdlRenderer, nullptr);
+    return;
+  }
+  // The viewport is set at scale 1 so it is in window pixels; the clip is then in screen pixels inside it
+  SDL_Rect screen{ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  SDL_RenderSetViewport(sdlRenderer, &outputRect);
+  SDL_RenderSetScale(sdlRenderer, float(outputRect.w) / SCREEN_WIDTH, float(outputRect.h) / SCREEN_HEIGHT);
+  SDL_RenderSetClipRect(sdlRenderer, &screen);
+}
+
+void Window::SetOutputScale(OutputScale mode, const SDL_Rect *area)
+{
+  outputScale = mode;
+  outputFollowsWindow = area == nullptr;
+  if (area)
+    outputArea = *area;
+}
+
+Window::OutputScale Window::GetOutputScale()
+{
+  return outputScale;
+}
+
+SDL_Rect Window::GetOutputRect()
+{
+  return outputRect;
+}
+
+void Window::QueueRect(DrawBatch::Kind kind, SDL_Rect rect, Pixel color)
+{
+  if (nPixelMode == Pixel::Mode::MASK && color.a != 255)
+    return;
+  SDL_BlendMode blend = nPixelMode == Pixel::Mode::ALPHA ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE;
+  ++batchedCommands;
+  // Join the newest batch with the same kind and color, unless a batch recorded
+  // after it overlaps this rect; reordering across that one would change the result
+  size_t i = batchCount;
+  while (i-- > 0)
+  {
+    DrawBatch &batch = batches[i];
+    if (batch.kind == kind && batch.blend == blend && batch.color == color)
+    {
+      batch.rects.push_back(rect);
+      SDL_UnionRect(&batch.bounds, &rect, &batch.bounds);
+      return;
+    }
+    if (SDL_HasIntersection(&batch.bounds, &rect))
+      break;
+  }
+  if (batchCount == batches.size())
+    batches.emplace_back();
+  DrawBatch &batch = batches[batchCount++];
+  batch.kind = kind;
+  batch.blend = blend;
+  batch.color = color;
+  batch.bounds = rect;
+  batch.rects.clear();
+  batch.rects.push_back(rect);
+}
+
+void Window::FlushBatches()
+{
+  // Each immediate rect would have cost a color change plus a draw call. A batch costs a blend mode,
+  // a color and a draw call, and the flush itself 7 more: 3 each to set and reset the screen transform
+  // and one to restore the blend mode.
+  const uint32_t immediateCalls = 2 * batchedCommands;
+  const uint32_t batchedCalls = batchCount ? 3 * uint32_t(batchCount) + 7 : 0;
+  sdlCallsSaved = immediateCalls > batchedCalls ? immediateCalls - batchedCalls : 0;
+  batchedCommands = 0;
+  if (batchCount == 0)
+    return;
+  SetScreenTransform(true);
+  for (size_t i = 0; i < batchCount; ++i)
+  {
+    DrawBatch &batch = batches[i];
+    SDL_SetRenderDrawBlendMode(sdlRenderer, batch.blend);
+    SDL_SetRenderDrawColor(sdlRenderer, batch.color.r, batch.color.g, batch.color.b, batch.blend == SDL_BLENDMODE_BLEND ? batch.color.a : 255);
+    if (batch.kind == DrawBatch::FILL)
+      SDL_RenderFillRects(sdlRenderer, batch.rects.data(), int(batch.rects.size()));
+    else
+      SDL_RenderDrawRects(sdlRenderer, batch.rects.data(), int(batch.rects.size()));
+    batch.rects.clear();
+  }
+  SDL_SetRenderDrawBlendMode(sdlRenderer, SDL_BLENDMODE_NONE);
+  SetScreenTransform(false);
+  batchCount = 0;
+}
+
+void Window::SetBatching(bool enabled)
+{
+  batching = enabled;
+}
+
+bool Window::GetBatching()
+{
+  return batching;
+}
+
+uint32_t Window::GetSDLCallsSaved()
+{
+  return sdlCallsSaved;
+}
+
+void Window::SwapBuffers()
+{
+  //SDL_UpdateWindowSurface(sdlWindow);
+  SDL_RenderPresent(sdlRenderer);
+}
+
+Sprite *Window::GetDrawTarget()
+{
+  // Callers read and write the frame directly, so everything recorded so far has to be in it
+  if (tiled)
+    FlushTiles();
+  return pFrameBuffer;
+}
+
+void Window::Invalidate(SDL_Rect *rect)
+{
+  SDL_Rect area{ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  if (rect)
+  {
+    area = *rect;
+    if (!ClipToScreen(area))
+      return;
+  }
+  for (int32_t y = area.y; y < area.y + area.h; y++)
+    MarkDirty(area.x, y, area.w);
+}
+
+void Window::SetFullRedraw(bool enabled)
+{
+  fullRedraw = enabled;
+}
+
+uint32_t Window::GetUploadedPixels()
+{
+  return uploadedPixels;
+}
+
+void Window::DrawCachedSprite(int32_t x, int32_t y, const Sprite &sprite, uint32_t scale, uint8_t flip)
+{
+  DrawPartialCachedSprite(x, y, sprite, 0, 0, sprite.GetWidth(), sprite.GetHeight(), scale, flip);
+}
+
+void Window::DrawPartialCachedSprite(int32_t x, int32_t y, const Sprite &sprite, int32_t ox, int32_t oy, int32_t w, int32_t h, uint32_t scale, uint8_t flip)
+{
+  if (scale == 0 || !sprite.GetData())
+    return;
+  SDL_Rect src{ ox, oy, w, h };
+  SDL_Rect bounds{ 0, 0, sprite.GetWidth(), sprite.GetHeight() };
+  if (!SDL_IntersectRect(&src, &bounds, &src))
+    return;
+  ShiftToTrimmed(x, y, { ox, oy, w, h }, src, scale, flip);
+  TextureDraw draw;
+  draw.sprite = &sprite;
+  draw.source = src;
+  draw.bounds = { x, y, src.w * int32_t(scale), src.h * int32_t(scale) };
+  SDL_Rect screen{ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+  if (!SDL_HasIntersection(&draw.bounds, &screen))
+    return;
+  draw.flip = SDL_RendererFlip(((flip & Sprite::HORIZ) ? SDL_FLIP_HORIZONTAL : 0) | ((flip & Sprite::VERT) ? SDL_FLIP_VERTICAL : 0));
+  draw.blend = nPixelMode == Pixel::Mode::ALPHA || nPixelMode == Pixel::Mode::MASK ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE;
+  textureDraws.push_back(draw);
+}
+
+SDL_Texture *Window::GetSpriteTexture(const Sprite &sprite)
+{
+  if (!sdlRenderer || !sprite.GetData())
+    return nullptr;
+  const int32_t w = sprite.GetWidth(), h = sprite.GetHeight();
+  auto found = spriteTextures.find(&sprite);
+  if (found != spriteTextures.end() && (found->second.width != w || found->second.height != h))
+  {
+    SDL_DestroyTexture(found->second.texture);
+    spriteTextures.erase(found);
+    found = spriteTextures.end();
+  }
+  if (found == spriteTextures.end())
+  {
+    SDL_Texture *texture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, w, h);
+    if (!texture)
+    {
+      Debug::LogError(std::string("Could not create sprite texture! SDL_Error: ") + std::string(SDL_GetError()));
+      return nullptr;
+    }
+    // Every row is newer than version 0, so the first upload covers the whole sprite
+    found = spriteTextures.emplace(&sprite, CachedTexture{ texture, w, h, 0, frameNumber }).first;
+  }
+  CachedTexture &cached = found->second;
+  cached.lastFrame = frameNumber;
+  const uint64_t version = sprite.GetVersion();
+  if (cached.version == version)
+    return cached.texture;
+  // Upload each run of rows changed since the cached version in one call
+  for (int32_t y = 0; y < h;)
+  {
+    if (sprite.GetRowVersion(y) <= cached.version)
+    {
+      y++;
+      continue;
+    }
+    int32_t end = y + 1;
+    while (end < h && sprite.GetRowVersion(end) > cached.version)
+      end++;
+    SDL_Rect rows{ 0, y, w, end - y };
+    SDL_UpdateTexture(cached.texture, &rows, sprite.GetData() + y * w, w * int(sizeof(Pixel)));
+    spriteTexturePixels += uint32_t(rows.w * rows.h);
+    y = end;
+  }
+  cached.version = version;
+  return cached.texture;
+}
+
+void Window::ReleaseSpriteTexture(const Sprite &sprite)
+{
+  auto found = spriteTextures.find(&sprite);
+  if (found == spriteTextures.end())
+    return;
+  SDL_DestroyTexture(found->second.texture);
+  spriteTextures.erase(found);
+}
+
+void Window::TrimSpriteTextures(uint32_t frames)
+{
+  for (auto it = spriteTextures.begin(); it != spriteTextures.end();)
+  {
+    if (frameNumber - it->second.lastFrame > frames)
+    {
+      SDL_DestroyTexture(it->second.texture);
+      it = spriteTextures.erase(it);
+    }
+    else
+      ++it;
+  }
+}
+
+uint32_t Window::GetSpriteTexturePixels()
+{
+  return spriteTexturePixels;
+}
+
+void Window::FlushTextureDraws()
+{
+  spriteTexturePixels = 0;
+  if (!sdlRenderer)
+    textureDraws.clear();
+  if (textureDraws.empty())
+    return;
+  SetScreenTransform(true);
+  for (const TextureDraw &draw : textureDraws)
+  {
+    SDL_Texture *texture = GetSpriteTexture(*draw.sprite);
+    if (!texture)
+      continue;
+    SDL_SetTextureBlendMode(texture, draw.blend);
+    SDL_RenderCopyEx(sdlRenderer, texture, &draw.source, &draw.bounds, 0.0, nullptr, draw.flip);
+  }
+  textureDraws.clear();
+  SetScreenTransform(false);
+}
+
+void Window::ClearSpriteTextures()
+{
+  for (auto &entry : spriteTextures)
+    SDL_DestroyTexture(entry.second.texture);
+  spriteTextures.clear();
+}
+
+void Window::StartCapture(const std::string &path, FrameCapture::Format format, unsigned poolSize, unsigned fps)
+{
+  StopCapture();
+  capture = new FrameCapture(path, format, SCREEN_WIDTH, SCREEN_HEIGHT, poolSize, fps);
+}
+
+void Window::StopCapture()
+{
+  if (capture)
+  {
+    delete capture;
+    capture = nullptr;
+  }
+}
+
+FrameCapture *Window::GetCapture()
+{
+  return capture;
+}
+
+void Window::CaptureFrame()
+{
+  // Without a renderer nothing is composited over the frame buffer
+  if (!sdlRenderer || outputRect.w <= 0 || outputRect.h <= 0)
+  {
+    capture->Submit(pFrameBuffer->GetData());
+    return;
+  }
+  const int32_t w = outputRect.w, h = outputRect.h;
+  if (captureOutput.size() != size_t(w) * h)
+    captureOutput.resize(size_t(w) * h);
+  if (captureFrame.empty())
+    captureFrame.resize(size_t(SCREEN_WIDTH) * SCREEN_HEIGHT);
+  SetScreenTransform(false);
+  if (SDL_RenderReadPixels(sdlRenderer, &outputRect, SDL_PIXELFORMAT_RGBA32, captureOutput.data(), w * int(sizeof(Pixel))))
+  {
+    Debug::LogError(std::string("Frame could not be read back for capture! SDL_Error: ") + std::string(SDL_GetError()));
+    return;
+  }
+  // Each screen pixel takes the first output pixel it was scaled to, so an unscaled frame comes back exactly
+  for (int32_t y = 0; y < SCREEN_HEIGHT; y++)
+  {
+    const Pixel *src = captureOutput.data() + size_t(std::min(outputRows[y], h - 1)) * w;
+    Pixel *dst = captureFrame.data() + size_t(y) * SCREEN_WIDTH;
+    for (int32_t x = 0; x < SCREEN_WIDTH; x++)
+    {
+      dst[x] = src[std::min(int32_t((int64_t(x) * w + SCREEN_WIDTH - 1) / SCREEN_WIDTH), w - 1)];
+      dst[x].a = 255;
+    }
+  }
+  capture->Submit(captureFrame.data());
+}
+
+void Window::EndFrame()
+{
+  if (midFrame)
+  {
+    ImGui::Render();
+    SetSDLRenderTarget(nullptr);
+    FlushTiles();
+    PresentFrameBuffer();
+    FlushBatches();
+    FlushTextureDraws();
+    ImGuiSDL::Render(ImGui::GetDrawData());
+    if (capture)
+      CaptureFrame();
+    SwapBuffers();
+    ReleaseSDLRenderer();
+    frameNumber++;
+    midFrame = false;
+  }
+}
+
+void Window::Update()
+{
+  EndFrame();
+  ImGui::NewFrame();
+  midFrame = true;
+}
+
+bool Window::HandleEvent(SDL_Event *event)
+{
+  // Lost textures come back undefined, so the next upload has to be a full one
+  if (event->type == SDL_RENDER_TARGETS_RESET || event->type == SDL_RENDER_DEVICE_RESET)
+    Invalidate();
+  // A lost device takes every texture with it, so cached sprites start over
+  if (event->type == SDL_RENDER_DEVICE_RESET)
+  {
+    ClearSpriteTextures();
+    // Including the frame texture, which the next present recreates
+    if (sdlFrameTexture)
+      SDL_DestroyTexture(sdlFrameTexture);
+    sdlFrameTexture = nullptr;
+    outputRect = { 0, 0, 0, 0 };
+  }
+  return false;
+}
+
+void Window::ConstructFontSheet()
+{
+  std::string data;
+  data += "?Q`0001oOch0o01o@F40o0<AGD4090LAGD<090@A7ch0?00O7Q`0600>00000000";
+  data += "O000000nOT0063Qo4d8>?7a14Gno94AA4gno94AaOT0>o3`oO400o7QN00000400";
+  data += "Of80001oOg<7O7moBGT7O7lABET024@aBEd714AiOdl717a_=TH013Q>00000000";
+  data += "720D000V?V5oB3Q_HdUoE7a9@DdDE4A9@DmoE4A;Hg]oM4Aj8S4D84@`00000000";
+  data += "OaPT1000Oa`^13P1@AI[?g`1@A=[OdAoHgljA4Ao?WlBA7l1710007l100000000";
+  data += "ObM6000oOfMV?3QoBDD`O7a0BDDH@5A0BDD<@5A0BGeVO5ao@CQR?5Po00000000";
+  data += "Oc``000?Ogij70PO2D]??0Ph2DUM@7i`2DTg@7lh2GUj?0TO0C1870T?00000000";
+  data += "70<4001o?P<7?1QoHg43O;`h@GT0@:@LB@d0>:@hN@L0@?aoN@<0O7ao0000?000";
+  data += "OcH0001SOglLA7mg24TnK7ln24US>0PL24U140PnOgl0>7QgOcH0K71S0000A000";
   data += "00H00000@Dm1S007@DUSg00?OdTnH7YhOfTL<7Yh@Cl0700?@Ah0300700000000";
   data += "<008001QL00ZA41a@6HnI<1i@FHLM81M@@0LG81?O`0nC?Y7?`0ZA7Y300080000";
   data += "O`082000Oh0827mo6>Hn?Wmo?6HnMb11MP08@C11H`08@FP0@@0004@000000000";
@@ -360,12 +2131,37 @@ void Window::ConstructFontSheet()
       if (++py == 48) { px++; py = 0; }
     }
   }
+
+  // Pre-expand each glyph to one byte per row (bit 0 is the leftmost pixel) so
+  // DrawString never has to sample the sheet
+  for (int c = 0; c < 96; c++)
+  {
+    int ox = (c % 16) * 8, oy = (c / 16) * 8;
+    for (int row = 0; row < 8; row++)
+    {
+      uint8_t bits = 0;
+      for (int i = 0; i < 8; i++)
+        if (fontSprite->GetPixel(ox + i, oy + row).r)
+          bits |= uint8_t(1 << i);
+      fontGlyphs[c][row] = bits;
+    }
+  }
 }
 SDL_Window *Window::GetSDLWindow()
 {
   return sdlWindow;
 }
 
+SDL_Surface *Window::GetSDLSurface()
+{
+  return sdlSurface;
+}
+
+bool Window::IsHeadless()
+{
+  return headless;
+}
+
 SDL_Renderer *Window::GetSDLRenderer()
 {
   return sdlRenderer;
@@ -0,0 +1,112 @@
+#define __WORKERPOOL_CPP
+
+#include <algorithm>
+
+#include "WorkerPool.hpp"
+
+#undef __WORKERPOOL_CPP
+
+WorkerPool::WorkerPool(unsigned count)
+{
+  if (count == 0)
+  {
+    unsigned hardware = std::thread::hardware_concurrency();
+    count = hardware > 1 ? hardware - 1 : 1;
+  }
+  for (unsigned i = 0; i < count; ++i)
+    threads.emplace_back(&WorkerPool::WorkerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(tasksLocked);
+    stopping = true;
+  }
+  tasksReady.notify_all();
+  for (std::thread &t : threads)
+    t.join();
+}
+
+void WorkerPool::WorkerLoop()
+{
+  for (;;)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasksLocked);
+      tasksReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void WorkerPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)> &job)
+{
+  if (count == 0)
+    return;
+  struct Shared
+  {
+    std::atomic<uint32_t> next{ 0 };
+    std::atomic<uint32_t> done{ 0 };
+    std::mutex finishedLocked;
+    std::condition_variable finished;
+  };
+  // Helpers can still be sitting in the queue after we return, so they hold their own reference
+  auto shared = std::make_shared<Shared>();
+  const std::function<void(uint32_t)> *pJob = &job;
+  auto run = [shared, pJob, count]()
+  {
+    uint32_t i;
+    while ((i = shared->next.fetch_add(1)) < count)
+    {
+      (*pJob)(i);
+      if (shared->done.fetch_add(1) + 1 == count)
+      {
+        std::lock_guard<std::mutex> lock(shared->finishedLocked);
+        shared->finished.notify_all();
+      }
+    }
+  };
+
+  unsigned helpers = std::min<unsigned>(unsigned(threads.size()), count - 1);
+  if (helpers)
+  {
+    {
+      std::lock_guard<std::mutex> lock(tasksLocked);
+      for (unsigned i = 0; i < helpers; ++i)
+        tasks.push_back(run);
+    }
+    tasksReady.notify_all();
+  }
+  run();
+  std::unique_lock<std::mutex> lock(shared->finishedLocked);
+  shared->finished.wait(lock, [&shared, count] { return shared->done.load() == count; });
+}
+
+std::future<void> WorkerPool::Submit(std::function<void()> task)
+{
+  auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+  std::future<void> result = packaged->get_future();
+  {
+    std::lock_guard<std::mutex> lock(tasksLocked);
+    tasks.push_back([packaged]() { (*packaged)(); });
+  }
+  tasksReady.notify_one();
+  return result;
+}
+
+unsigned WorkerPool::GetThreadCount()
+{
+  return unsigned(threads.size());
+}
+
+WorkerPool &WorkerPool::Get()
+{
+  static WorkerPool pool;
+  return pool;
+}